@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Runs a list of jobs, each a ROM, a frame count and an optional input
+ * script, on independent emulator instances spread over every core by a
+ * work-stealing pool. Each job reports what the game sent over the serial
+ * port, hashes of its RAM and of the last frame, its emulated frames per
+ * second and how much of the instance is resident. ROM images are shared by
+ * every job that runs them. */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <nds.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "apu.h"
+#include "bench.h"
+#include "cart.h"
+#include "gb.h"
+#include "hash.h"
+#include "joypad.h"
+#include "loader.h"
+#include "pool.h"
+#include "rom.h"
+#include "serial.h"
+
+uint16_t VRAM_A[SCREEN_WIDTH * SCREEN_HEIGHT];
+int      sstep = 0;
+
+/* From this frame on, these buttons are held. */
+typedef struct {
+  int     frame;
+  uint8_t buttons;
+} step_t;
+
+typedef struct {
+  char    *name;
+  rom_t   *rom;      /* Held until the job finishes. */
+  int      frames;
+  char    *script_path;
+  step_t  *script;
+  int      steps;
+  
+  /* Results. */
+  const char *error;
+  char       *serial;
+  size_t      serial_len, serial_size;
+  uint32_t    ram_hash, frame_hash;
+  double      seconds;
+  size_t      resident;
+  int         cpu;
+} job_t;
+
+static job_t  *jobs      = NULL;
+static int     job_count = 0;
+static int     render    = 1;
+static pool_t  pool;
+
+static void die(const char *what, const char *name) {
+  fprintf(stderr, "orchard-batch: %s: %s\n", what, name);
+  exit(EXIT_FAILURE);
+}
+
+/* Reads a whole file into memory, with a terminating 0 for text. */
+static uint8_t *read_file(const char *name, size_t *size) {
+  FILE    *f = fopen(name, "rb");
+  uint8_t *data;
+  long     n;
+  
+  if(!f)
+    die("can't open", name);
+  
+  fseek(f, 0, SEEK_END);
+  n = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  
+  if((n < 0) || !(data = malloc(n + 1)) || (fread(data, 1, n, f) != (size_t)n))
+    die("can't read", name);
+  data[n] = 0;
+  fclose(f);
+  
+  *size = n;
+  return data;
+}
+
+/* Counts the bytes of a block that are resident, in whole pages. Pages an
+ * instance never touched, such as unused CGB banks or buffers of a disabled
+ * feature, aren't. */
+static size_t resident(const void *data, size_t size) {
+  long           page = sysconf(_SC_PAGESIZE);
+  uintptr_t      from, to;
+  unsigned char *vec;
+  size_t         n, i, count = 0;
+  
+  if(!data || !size)
+    return 0;
+  
+  from = (uintptr_t)data & ~(uintptr_t)(page - 1);
+  to   = ((uintptr_t)data + size + page - 1) & ~(uintptr_t)(page - 1);
+  n    = (to - from) / page;
+  
+  if(!(vec = malloc(n)))
+    return 0;
+  if(!mincore((void *)from, to - from, vec))
+    for(i = 0; i < n; ++i) count += vec[i] & 1;
+  free(vec);
+  
+  return count * page;
+}
+
+/* Parses buttons as names joined by '+', such as "a+right", or "-" for
+ * none. Returns -1 for an unknown name. */
+static int parse_buttons(char *s) {
+  static const char *names[8] = {
+    "right", "left", "up", "down", "a", "b", "select", "start"
+  };
+  int   buttons = 0;
+  char *name;
+  
+  if(!strcmp(s, "-"))
+    return 0;
+  
+  for(name = strtok(s, "+"); name; name = strtok(NULL, "+")) {
+    int i;
+    
+    for(i = 0; i < 8; ++i)
+      if(!strcasecmp(name, names[i])) break;
+    if(i == 8)
+      return -1;
+    buttons |= 1 << i;
+  }
+  
+  return buttons;
+}
+
+/* Reads an input script: lines of "frame buttons", in frame order, each
+ * setting the buttons held from that frame on. '#' starts a comment. */
+static void load_script(job_t *job) {
+  size_t  size;
+  char   *text = (char *)read_file(job->script_path, &size);
+  char   *line, *next;
+  int     n    = 0;
+  
+  for(line = text; line; line = next) {
+    char buttons[64];
+    int  frame, b;
+    
+    if((next = strchr(line, '\n'))) *next++ = 0;
+    if(strchr(line, '#')) *strchr(line, '#') = 0;
+    if(sscanf(line, "%d %63s", &frame, buttons) != 2)
+      continue;
+    
+    if(((b = parse_buttons(buttons)) < 0) || (n && (frame < job->script[n-1].frame)))
+      die("bad input script line", line);
+    
+    job->script = realloc(job->script, sizeof *job->script * (n + 1));
+    if(!job->script)
+      die("out of memory reading", job->script_path);
+    job->script[n].frame   = frame;
+    job->script[n].buttons = b;
+    ++n;
+  }
+  
+  job->steps = n;
+  free(text);
+}
+
+/* Reads the job list: lines of "rom frames [script]". '#' starts a
+ * comment. */
+static void load_jobs(const char *name) {
+  size_t  size;
+  char   *text = (char *)read_file(name, &size);
+  char   *line, *next;
+  
+  for(line = text; line; line = next) {
+    char   rom[1024], script[1024];
+    int    frames, fields;
+    job_t *job;
+    
+    if((next = strchr(line, '\n'))) *next++ = 0;
+    if(strchr(line, '#')) *strchr(line, '#') = 0;
+    fields = sscanf(line, "%1023s %d %1023s", rom, &frames, script);
+    if(fields <= 0)
+      continue;
+    if((fields < 2) || (frames <= 0))
+      die("bad job line", line);
+    
+    jobs = realloc(jobs, sizeof *jobs * (job_count + 1));
+    if(!jobs)
+      die("out of memory reading", name);
+    job = &jobs[job_count++];
+    memset(job, 0, sizeof *job);
+    
+    if(!(job->name = strdup(rom)) || !(job->rom = rom_open(rom)))
+      die("can't read", rom);
+    job->frames = frames;
+    if(fields == 3) {
+      job->script_path = strdup(script);
+      load_script(job);
+    }
+  }
+  
+  free(text);
+}
+
+/* Collects what the game sends over the serial port. */
+static void serial_hook(gb_t *gb, uint8_t byte) {
+  job_t *job = gb->user;
+  
+  if(job->serial_len == job->serial_size) {
+    size_t size   = job->serial_size ? job->serial_size * 2 : 256;
+    char  *serial = realloc(job->serial, size);
+    
+    if(!serial)
+      return;
+    job->serial      = serial;
+    job->serial_size = size;
+  }
+  job->serial[job->serial_len++] = byte;
+}
+
+/* Hashes cartridge RAM, work RAM with every CGB bank, and HRAM. */
+static uint32_t ram_hash(gb_t *gb) {
+  uint32_t h = HASH_INIT;
+  
+  if(gb->cart.ram) h = hash_fnv(h, gb->cart.ram, gb->cart.ram_size);
+  else             h = hash_fnv(h, &MEM(0xa000), 0x2000);
+  h = hash_fnv(h, &MEM(0xc000), 0x2000);
+  if(gb->cgb.enabled)
+    h = hash_fnv(h, gb->cgb.wram, sizeof gb->cgb.wram);
+  return hash_fnv(h, &MEM(0xff80), 0x7f);
+}
+
+/* Runs one job on a fresh instance. */
+static void run_job(void *arg) {
+  job_t    *job    = arg;
+  gb_t     *gb     = calloc(1, sizeof *gb);
+  uint16_t *pixels = calloc(160 * 144, sizeof *pixels);
+  double    start;
+  int       i, step = 0;
+  
+  job->cpu = sched_getcpu();
+  
+  if(!gb || !pixels) {
+    job->error = "out of memory";
+    goto done;
+  }
+  if(!cart_load(gb, job->rom)) {
+    job->error = "out of memory";
+    goto done;
+  }
+  
+  gb->user = job;
+  gb_set_framebuffer(gb, pixels, 160);
+  gb_init(gb);
+  gb_set_render_mode(gb, render ? GB_RENDER_DEFERRED : GB_RENDER_NONE);
+  apu_enable(gb, 0);
+  serial_set_hook(gb, serial_hook);
+  
+  start = bench_now();
+  for(i = 0; i < job->frames; ++i) {
+    while((step < job->steps) && (job->script[step].frame <= i))
+      joypad_set(gb, job->script[step++].buttons);
+    gb_run(gb);
+  }
+  job->seconds = bench_now() - start;
+  
+  job->ram_hash   = ram_hash(gb);
+  job->frame_hash = hash_fnv(HASH_INIT, pixels, 160 * 144 * sizeof *pixels);
+  job->resident   = resident(gb, sizeof *gb) + resident(gb->cart.ram, gb->cart.ram_size);
+  gb_release(gb);
+  
+done:
+  free(pixels);
+  free(gb);
+  rom_unref(job->rom);
+  job->rom = NULL;
+}
+
+/* Orders jobs by length. */
+static int shorter(const void *a, const void *b) {
+  return (*(job_t * const *)a)->frames - (*(job_t * const *)b)->frames;
+}
+
+/* Prints serial output as a C string, cut short past max bytes. */
+static void print_serial(const job_t *job, size_t max) {
+  size_t i;
+  
+  putchar('"');
+  for(i = 0; (i < job->serial_len) && (i < max); ++i) {
+    uint8_t c = job->serial[i];
+    
+    if(c == '\n')                     printf("\\n");
+    else if((c == '"') || (c == '\\')) printf("\\%c", c);
+    else if(isprint(c))               putchar(c);
+    else                              printf("\\x%02x", c);
+  }
+  putchar('"');
+  if(job->serial_len > max)
+    printf("... (%lu bytes)", (unsigned long)job->serial_len);
+}
+
+static void usage(void) {
+  fprintf(stderr,
+    "usage: orchard-batch [-j threads] [-n] [-s bytes] jobs.txt\n"
+    "  -j n      run on n threads (default: one per core)\n"
+    "  -n        logic only; the frame hash is of a blank screen\n"
+    "  -s n      print up to n bytes of each job's serial output (default 256)\n"
+    "\n"
+    "each line of the job list is \"rom frames [script]\"; each line of a\n"
+    "script is \"frame buttons\", buttons being names joined by '+' from\n"
+    "right left up down a b select start, or '-' for none.\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  int     threads    = 0;
+  size_t  serial_max = 256;
+  double  start, wall, frames = 0, cpu_time = 0, ram = 0;
+  job_t **order;
+  size_t  rom_bytes;
+  int     i, images;
+  
+  for(i = 1; i < argc - 1; ++i) {
+    if(!strcmp(argv[i], "-j") && (i + 1 < argc - 1))      threads    = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "-n"))                       render     = 0;
+    else if(!strcmp(argv[i], "-s") && (i + 1 < argc - 1)) serial_max = atoi(argv[++i]);
+    else usage();
+  }
+  if((argc < 2) || (threads < 0))
+    usage();
+  
+  load_jobs(argv[argc-1]);
+  if(!pool_init(&pool, threads))
+    die("out of memory", "starting threads");
+  
+  /* Workers run their newest task first, so pushing the shortest jobs
+   * first starts the longest ones first and leaves short ones to even out
+   * the end. */
+  order = malloc(sizeof *order * job_count);
+  if(!order)
+    die("out of memory", "queueing jobs");
+  for(i = 0; i < job_count; ++i)
+    order[i] = &jobs[i];
+  qsort(order, job_count, sizeof *order, shorter);
+  for(i = 0; i < job_count; ++i)
+    if(!pool_push(&pool, run_job, order[i]))
+      die("out of memory", "queueing jobs");
+  free(order);
+  
+  /* Jobs let go of their ROMs as they finish, so count the images first. */
+  rom_stats(&images, &rom_bytes);
+  
+  start = bench_now();
+  pool_run(&pool);
+  wall  = bench_now() - start;
+  
+  for(i = 0; i < job_count; ++i) {
+    const job_t *job = &jobs[i];
+    
+    printf("%d %s", i + 1, job->name);
+    if(job->script_path) printf(" %s", job->script_path);
+    
+    if(job->error) {
+      printf(": %s\n", job->error);
+      continue;
+    }
+    
+    printf(": %d frames, %.1f frames/s on cpu %d, %lu KB resident, ram %08x, "
+           "frame %08x, serial ", job->frames, job->frames / job->seconds,
+      job->cpu, (unsigned long)(job->resident >> 10), (unsigned)job->ram_hash,
+      (unsigned)job->frame_hash);
+    print_serial(job, serial_max);
+    putchar('\n');
+    
+    frames   += job->frames;
+    cpu_time += job->seconds;
+    ram      += job->resident;
+  }
+  
+  printf("%d shared ROM images, %lu KB; instances %lu KB each, %.0f KB "
+         "resident on average\n", images, (unsigned long)(rom_bytes >> 10),
+    (unsigned long)(sizeof(gb_t) >> 10), ram / job_count / 1024);
+  
+  printf("%d jobs, %.0f frames in %.2f s on %d threads: %.1f frames/s "
+         "(%.1f per thread)\n", job_count, frames, wall, pool.threads,
+    frames / wall, frames / cpu_time);
+  for(i = 0; i < pool.threads; ++i) {
+    const pool_worker_t *w = &pool.workers[i];
+    
+    printf("  thread %d on cpu %d: %u jobs, %u stolen, busy %.0f%%\n", i,
+      w->cpu, (unsigned)w->tasks, (unsigned)w->steals, 100 * w->busy / wall);
+  }
+  
+  pool_free(&pool);
+  return 0;
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "rom.h"
+
+static const uint8_t loop[] = {
+  0x21, 0x00, 0xc0, /* ld hl, 0xc000 */
+  0x04,             /* inc b */
+  0x78,             /* ld a, b */
+  0x22,             /* ld (hl+), a */
+  0x7c,             /* ld a, h */
+  0xfe, 0xe0,       /* cp 0xe0 */
+  0x20, 0xf8,       /* jr nz, -8 */
+  0x26, 0xc0,       /* ld h, 0xc0 */
+  0x18, 0xf4        /* jr -12 */
+};
+
+double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Returns a private image of the loop, padded to 32 KB. */
+rom_t *bench_rom(void) {
+  static uint8_t image[0x8000];
+  
+  memcpy(&image[0x100], loop, sizeof loop);
+  return rom_create(NULL, image, sizeof image);
+}
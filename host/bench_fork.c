@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* What forking costs against a savestate copy, and what each branch ends
+ * up holding of its own. Runs the ROM given, or the built-in loop
+ * bench_state uses, for a few seconds of game time, then forks BRANCHES
+ * instances from it, each of which runs a frame with different buttons,
+ * as a planner would. Also checks that a forked branch runs exactly like
+ * one loaded from a savestate, and that the parent isn't disturbed. */
+
+#include <nds.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apu.h"
+#include "bench.h"
+#include "cart.h"
+#include "gb.h"
+#include "rom.h"
+#include "state.h"
+
+#define WARMUP   300
+#define BRANCHES 256
+
+uint16_t VRAM_A[SCREEN_WIDTH * SCREEN_HEIGHT];
+int      sstep = 0;
+
+static gb_t *branch[BRANCHES];
+
+static gb_t *instance(rom_t *rom) {
+  gb_t *gb = calloc(1, sizeof *gb);
+  
+  if(!gb || !cart_load(gb, rom)) {
+    fprintf(stderr, "bench_fork: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  gb_init(gb);
+  gb_set_render_mode(gb, GB_RENDER_NONE);
+  apu_enable(gb, 0);
+  return gb;
+}
+
+/* Whether two instances would save the same state. */
+static int same(gb_t *a, gb_t *b, uint8_t *x, uint8_t *y, size_t size) {
+  size_t n = state_save(a, x, size, 0);
+  
+  return (state_save(b, y, size, 0) == n) && !memcmp(x, y, n);
+}
+
+int main(int argc, char **argv) {
+  rom_t   *rom = (argc > 1) ? rom_open(argv[1]) : bench_rom();
+  gb_t    *parent, *check;
+  uint8_t *state, *x, *y;
+  size_t   size, n;
+  double   start, t_fork, t_copy;
+  uint32_t copies = 0;
+  int      i, slots, shared = 0, differ = 0;
+  
+  if(!rom) {
+    fprintf(stderr, "bench_fork: can't load %s\n", (argc > 1) ? argv[1] : "the built-in ROM");
+    return EXIT_FAILURE;
+  }
+  
+  parent = instance(rom);
+  check  = instance(rom);
+  for(i = 0; i < BRANCHES; ++i) branch[i] = instance(rom);
+  for(i = 0; i < WARMUP; ++i) gb_run(parent);
+  
+  size  = state_size(parent);
+  state = malloc(size);
+  x     = malloc(size);
+  y     = malloc(size);
+  slots = fork_slots(parent);
+  if(!state || !x || !y)
+    return EXIT_FAILURE;
+  
+  printf("%s, after %d frames, %d branches:\n",
+    (argc > 1) ? argv[1] : "built-in ROM", WARMUP, BRANCHES);
+  
+  /* Copying: one save, then a load into every branch. */
+  start = bench_now();
+  n = state_save(parent, state, size, 0);
+  for(i = 0; i < BRANCHES; ++i) state_load(branch[i], state, n);
+  t_copy = bench_now() - start;
+  
+  start = bench_now();
+  for(i = 0; i < BRANCHES; ++i) state_fork(branch[i], parent);
+  t_fork = bench_now() - start;
+  
+  printf("  fork %6.2f us a branch, against %6.2f for a savestate copy\n",
+    t_fork / BRANCHES * 1e6, t_copy / BRANCHES * 1e6);
+  
+  /* Every branch runs a frame with buttons of its own, and has to end up
+   * where one loaded from the state does. */
+  for(i = 0; i < BRANCHES; ++i) {
+    joypad_set(branch[i], i & 0xff);
+    gb_run(branch[i]);
+    copies += branch[i]->fork.copies;
+    shared += branch[i]->fork.held;
+    
+    state_load(check, state, n);
+    joypad_set(check, i & 0xff);
+    gb_run(check);
+    differ += !same(branch[i], check, x, y, size);
+  }
+  
+  printf("  after a frame, %.1f of %d pages copied a branch (%.1f KB), "
+         "%.1f still shared\n", (double)copies / BRANCHES, slots,
+    (double)copies / BRANCHES * FORK_PAGE / 1024, (double)shared / BRANCHES);
+  printf("  an instance is %lu KB besides; %d branches differ from a loaded state\n",
+    (unsigned long)(sizeof *parent >> 10), differ);
+  
+  /* The parent writes to what it shares too, and runs on undisturbed. */
+  state_load(check, state, n);
+  for(i = 0; i < 60; ++i) {
+    gb_run(parent);
+    gb_run(check);
+  }
+  printf("  parent 60 frames on: %s\n",
+    same(parent, check, x, y, size) ? "as without forks" : "DIFFERENT");
+  differ += !same(parent, check, x, y, size);
+  
+  for(i = 0; i < BRANCHES; ++i) {
+    gb_release(branch[i]);
+    free(branch[i]);
+  }
+  gb_release(parent);
+  gb_release(check);
+  free(parent);
+  free(check);
+  rom_unref(rom);
+  free(state);
+  free(x);
+  free(y);
+  return differ ? EXIT_FAILURE : 0;
+}
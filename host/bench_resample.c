@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Speed and quality of the resampler at each filter length, bringing the
+ * APU's 65536 Hz output to 48000 Hz. Quality is measured with test tones:
+ * signal to noise and distortion for a tone well inside the passband, the
+ * gain near the top of it, and how far a tone above the output's Nyquist
+ * frequency is attenuated before it aliases. */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "apu.h"
+#include "bench.h"
+#include "resample.h"
+
+#define IN_RATE  APU_RATE
+#define OUT_RATE 48000
+#define SECONDS  4
+
+static resampler_t r;
+static int16_t     in[IN_RATE * SECONDS * 2];
+static int16_t     out[OUT_RATE * SECONDS * 2 + 1024];
+
+/* Fills the input with a tone of the given frequency and amplitude. */
+static void tone(double freq, double amp) {
+  int i;
+  
+  for(i = 0; i < IN_RATE * SECONDS; ++i)
+    in[i * 2] = in[i * 2 + 1] = (int16_t)lrint(amp * sin(2 * M_PI * freq * i / IN_RATE));
+}
+
+/* Streams the whole input through in blocks the size the emulator produces
+ * each frame, and returns the number of output frames. */
+static int stream(void) {
+  int done = 0, n = 0;
+  
+  while(done < IN_RATE * SECONDS) {
+    int block = IN_RATE / 60;
+    
+    if(block > IN_RATE * SECONDS - done) block = IN_RATE * SECONDS - done;
+    done += resampler_write(&r, &in[done * 2], block);
+    n    += resampler_read(&r, &out[n * 2], OUT_RATE * SECONDS + 512 - n);
+  }
+  
+  return n;
+}
+
+/* Fits a sine of the given output frequency to the left channel, skipping
+ * the filter's start-up, and returns its amplitude. The residual's power
+ * relative to the sine's is stored in *noise_db. */
+static double fit(double freq, int n, double *noise_db) {
+  double w = 2 * M_PI * freq / OUT_RATE;
+  double a = 0, b = 0, signal, noise = 0;
+  int    i, first = 256, count;
+  
+  n     = n - first - (n - first) % (int)(OUT_RATE / freq + 1);
+  count = n;
+  for(i = 0; i < count; ++i) {
+    a += out[(first + i) * 2] * sin(w * i);
+    b += out[(first + i) * 2] * cos(w * i);
+  }
+  a *= 2.0 / count;
+  b *= 2.0 / count;
+  
+  for(i = 0; i < count; ++i) {
+    double e = out[(first + i) * 2] - a * sin(w * i) - b * cos(w * i);
+    noise += e * e;
+  }
+  
+  signal    = (a * a + b * b) / 2;
+  *noise_db = 10 * log10(noise / count / signal);
+  return sqrt(a * a + b * b);
+}
+
+static void bench_kernels(void) {
+  static int16_t x[RESAMPLE_MAX_TAPS], k[RESAMPLE_MAX_TAPS];
+  volatile int32_t sink;
+  int              taps, i;
+  
+  for(i = 0; i < RESAMPLE_MAX_TAPS; ++i) {
+    x[i] = (i * 2654435761u) >> 16;
+    k[i] = (i * 40503u) >> 1;
+  }
+  
+  printf("dot product (taps/us):\n");
+  for(taps = 8; taps <= RESAMPLE_MAX_TAPS; taps *= 2) {
+    double start, generic;
+    long   count = 200000000 / taps;
+    
+    start = bench_now();
+    for(i = 0; i < count; ++i) sink = resample_dot_generic(x, k, taps) + i;
+    generic = count * taps / (bench_now() - start) / 1e6;
+    
+    start = bench_now();
+    for(i = 0; i < count; ++i) sink = resample_dot(x, k, taps) + i;
+    printf("  %2d taps: %8.1f generic, %8.1f\n", taps, generic,
+      count * taps / (bench_now() - start) / 1e6);
+  }
+  (void)sink;
+}
+
+static void bench_filters(void) {
+  static const int lengths[] = { 8, 16, 24, 32, 48, 64 };
+  int              i;
+  
+  printf("%d Hz to %d Hz:\n", IN_RATE, OUT_RATE);
+  printf("  taps  Mframes/s  1 kHz S/(N+D)  gain at 18 kHz  alias of 28 kHz\n");
+  
+  for(i = 0; i < (int)(sizeof lengths / sizeof lengths[0]); ++i) {
+    double start, speed, sinad, gain, alias, unused;
+    int    n, reps;
+    
+    resampler_init(&r, lengths[i], IN_RATE, OUT_RATE);
+    tone(1000, 16000);
+    start = bench_now();
+    for(reps = 0; reps < 8; ++reps) n = stream();
+    speed = reps * n / (bench_now() - start) / 1e6;
+    fit(1000, n, &sinad);
+    
+    resampler_init(&r, lengths[i], IN_RATE, OUT_RATE);
+    tone(18000, 16000);
+    gain = 20 * log10(fit(18000, stream(), &unused) / 16000);
+    
+    /* 28 kHz would fold back to 20 kHz. */
+    resampler_init(&r, lengths[i], IN_RATE, OUT_RATE);
+    tone(28000, 16000);
+    alias = 20 * log10(fit(OUT_RATE - 28000, stream(), &unused) / 16000 + 1e-9);
+    
+    printf("  %4d  %9.1f  %10.1f dB  %11.2f dB  %12.1f dB\n",
+      lengths[i], speed, -sinad, gain, alias);
+  }
+}
+
+int main(void) {
+  bench_kernels();
+  bench_filters();
+  return 0;
+}
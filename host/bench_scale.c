@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Throughput benchmarks for the output scaler kernels, comparing the SIMD
+ * versions with the generic ones, and for whole frames at common sizes. */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "scale.h"
+
+#define LINES 200000
+
+static uint16_t src[161];
+static uint32_t rgba[161], rgba2[161];
+static uint32_t out[SCALE_MAX_WIDTH * 4];
+static uint16_t x0[SCALE_MAX_WIDTH], fx[SCALE_MAX_WIDTH];
+
+/* Prints output megapixels per second for a kernel run over LINES lines. */
+static void report(const char *name, double start, long pixels) {
+  printf("  %-28s %8.1f Mpixel/s\n", name, pixels / (bench_now() - start) / 1e6);
+}
+
+static void bench_kernels(void) {
+  double start;
+  int    i, f;
+  
+  printf("kernels (%d lines each):\n", LINES);
+  
+  start = bench_now();
+  for(i = 0; i < LINES; ++i) scale_convert_generic(src, rgba, 160);
+  report("convert rgb15 generic", start, 160L * LINES);
+  
+  start = bench_now();
+  for(i = 0; i < LINES; ++i) scale_convert(src, rgba, 160);
+  report("convert rgb15", start, 160L * LINES);
+  
+  for(f = 2; f <= 4; ++f) {
+    char name[32];
+    
+    sprintf(name, "repeat %dx generic", f);
+    start = bench_now();
+    for(i = 0; i < LINES; ++i) scale_repeat_generic(rgba, out, 160, f);
+    report(name, start, 160L * f * LINES);
+    
+    sprintf(name, "repeat %dx", f);
+    start = bench_now();
+    for(i = 0; i < LINES; ++i) scale_repeat(rgba, out, 160, f);
+    report(name, start, 160L * f * LINES);
+  }
+  
+  start = bench_now();
+  for(i = 0; i < LINES; ++i) scale_blend_generic(rgba, rgba2, out, 161, i & 0xff);
+  report("blend rows generic", start, 161L * LINES);
+  
+  start = bench_now();
+  for(i = 0; i < LINES; ++i) scale_blend(rgba, rgba2, out, 161, i & 0xff);
+  report("blend rows", start, 161L * LINES);
+  
+  for(i = 0; i < 1280; ++i) {
+    x0[i] = i * 159 / 1280;
+    fx[i] = (i * 37) & 0xff;
+  }
+  
+  start = bench_now();
+  for(i = 0; i < LINES / 8; ++i) scale_stretch_generic(rgba, out, x0, fx, 1280);
+  report("stretch to 1280 generic", start, 1280L * (LINES / 8));
+  
+  start = bench_now();
+  for(i = 0; i < LINES / 8; ++i) scale_stretch(rgba, out, x0, fx, 1280);
+  report("stretch to 1280", start, 1280L * (LINES / 8));
+}
+
+/* Streams whole frames through a scaler, one line at a time, filling the
+ * target or by a whole factor in the middle of it. */
+static void bench_frames(int width, int height, int frames, int whole) {
+  static scaler_t s;
+  uint32_t       *dst = malloc(sizeof *dst * width * height);
+  double          start;
+  int             i, ly;
+  
+  if(!dst || !(whole ? scaler_init_integer : scaler_init)(&s, dst, width, width, height)) {
+    printf("  %dx%d: unsupported\n", width, height);
+    free(dst);
+    return;
+  }
+  
+  start = bench_now();
+  for(i = 0; i < frames; ++i) {
+    for(ly = 0; ly < 144; ++ly)
+      scaler_line(&s, ly, src);
+    scaler_flush(&s);
+  }
+  
+  printf("  %4dx%-4d %-9s %8.1f frames/s\n", width, height,
+    !s.factor ? "bilinear" : whole ? "centred" : "integer", frames / (bench_now() - start));
+  free(dst);
+}
+
+int main(void) {
+  int i;
+  
+  for(i = 0; i < 161; ++i) src[i] = (i * 2654435761u) >> 17;
+  scale_convert_generic(src, rgba, 161);
+  for(i = 0; i < 161; ++i) rgba2[i] = ~rgba[i];
+  
+  bench_kernels();
+  
+  printf("frames (160x144 in):\n");
+  bench_frames(320, 288, 2000, 0);
+  bench_frames(480, 432, 2000, 0);
+  bench_frames(640, 576, 2000, 0);
+  bench_frames(1280, 720, 500, 0);
+  bench_frames(1920, 1080, 200, 0);
+  bench_frames(1280, 720, 2000, 1);
+  bench_frames(1920, 1080, 2000, 1);
+  
+  return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* How well the snapshot store shares pages between the states of a real
+ * game, and what inserting, finding and restoring cost. Runs the ROM given,
+ * or the built-in loop bench_state uses, for the number of frames given
+ * (3600 by default) and stores the state after every one, then restores
+ * every tenth, checks it is the state stored and finds it again. */
+
+#include <nds.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apu.h"
+#include "bench.h"
+#include "cart.h"
+#include "gb.h"
+#include "hash.h"
+#include "rom.h"
+#include "snap.h"
+#include "state.h"
+
+uint16_t VRAM_A[SCREEN_WIDTH * SCREEN_HEIGHT];
+int      sstep = 0;
+
+int main(int argc, char **argv) {
+  rom_t        *rom    = (argc > 1) ? rom_open(argv[1]) : bench_rom();
+  int           frames = (argc > 2) ? atoi(argv[2]) : 3600;
+  gb_t         *gb     = calloc(1, sizeof *gb);
+  snap_store_t  st;
+  uint32_t     *handle;
+  uint32_t     *hash;
+  uint8_t      *buf;
+  size_t        size, n;
+  double        start, t_run = 0, t_insert = 0, t_restore = 0, t_load = 0, t_find = 0;
+  int           i, checked = 0, bad_restore = 0, bad_find = 0, wrong;
+  
+  if(!gb || !rom || (frames <= 0) || !cart_load(gb, rom)) {
+    fprintf(stderr, "bench_snap: can't load %s\n", (argc > 1) ? argv[1] : "the built-in ROM");
+    return EXIT_FAILURE;
+  }
+  rom_unref(rom);
+  gb_init(gb);
+  gb_set_render_mode(gb, GB_RENDER_NONE);
+  apu_enable(gb, 0);
+  
+  size   = state_size(gb);
+  buf    = malloc(size);
+  handle = malloc(sizeof *handle * frames);
+  hash   = malloc(sizeof *hash * frames);
+  if(!buf || !handle || !hash || !snap_init(&st, state_memory(gb)))
+    return EXIT_FAILURE;
+  
+  for(i = 0; i < frames; ++i) {
+    start = bench_now();
+    gb_run(gb);
+    t_run += bench_now() - start;
+    
+    n       = state_save(gb, buf, size, 0);
+    hash[i] = hash_fnv(HASH_INIT, buf, n);
+    start   = bench_now();
+    handle[i] = snap_insert(&st, buf, n);
+    t_insert += bench_now() - start;
+    
+    if(handle[i] == SNAP_NONE) {
+      fprintf(stderr, "bench_snap: out of memory after %d frames\n", i);
+      return EXIT_FAILURE;
+    }
+  }
+  
+  for(i = 0; i < frames; i += 10, ++checked) {
+    uint32_t found;
+    
+    start = bench_now();
+    n = snap_restore(&st, handle[i], buf, size);
+    t_restore += bench_now() - start;
+    bad_restore += (hash_fnv(HASH_INIT, buf, n) != hash[i]);
+    
+    start = bench_now();
+    found = snap_find(&st, buf, n);
+    t_find += bench_now() - start;
+    bad_find += (found != handle[i]);
+    
+    start = bench_now();
+    state_load(gb, buf, n);
+    t_load += bench_now() - start;
+  }
+  
+  printf("%s, %d frames, a %lu byte state a frame:\n",
+    (argc > 1) ? argv[1] : "built-in ROM", frames, (unsigned long)n);
+  printf("  %u distinct states in %u pages, %.1f MB held in %.1f MB: %.1fx\n",
+    (unsigned)st.snaps.live, (unsigned)st.pages.live, st.held / 1048576.0,
+    st.stored / 1048576.0, (double)st.held / st.stored);
+  printf("  insert %.1f us, restore %.1f us (%.1f more to load it), find %.1f us; "
+         "a frame runs in %.1f us\n", t_insert / frames * 1e6, t_restore / checked * 1e6,
+    t_load / checked * 1e6, t_find / checked * 1e6, t_run / frames * 1e6);
+  printf("  %d of %d restored states as stored, %d of %d found again\n",
+    checked - bad_restore, checked, checked - bad_find, checked);
+  wrong = bad_restore || bad_find;
+  
+  for(i = 0; i < frames; ++i) snap_release(&st, handle[i]);
+  if(st.pages.live || st.snaps.live || st.held || st.stored) {
+    printf("  RELEASING ALL LEFT %u pages, %u states\n", (unsigned)st.pages.live,
+      (unsigned)st.snaps.live);
+    wrong = 1;
+  }
+  
+  snap_free(&st);
+  gb_release(gb);
+  free(gb);
+  free(buf);
+  free(handle);
+  free(hash);
+  return wrong ? EXIT_FAILURE : 0;
+}
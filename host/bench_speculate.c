@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* What speculation takes off the path from the buttons to the frame shown.
+ * Plays the ROM given, or a built-in loop rewriting VRAM, with scripted
+ * buttons that change every few frames among a handful, like a game being
+ * played. Each frame is run once with run-ahead and once with speculative
+ * branches, with a pause between frames standing in for the wait for the
+ * display, and the time each call takes is what counts. The frames shown
+ * both ways have to match, and while the buttons stay put a run-ahead frame
+ * has to match the frame a plain run shows that many frames later. */
+
+#include <nds.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+#include "cart.h"
+#include "gb.h"
+#include "hash.h"
+#include "rom.h"
+#include "runahead.h"
+#include "speculate.h"
+
+#define FRAMES   1200
+#define AHEAD    2
+#define BRANCHES 4
+#define IDLE_US  4000
+
+uint16_t VRAM_A[SCREEN_WIDTH * SCREEN_HEIGHT];
+int      sstep = 0;
+
+/* Nothing, right, right and A, left, and B, held for 4 to 35 frames. */
+static const uint8_t held[] = { 0x00, 0x10, 0x11, 0x20, 0x02 };
+
+/* Counts through VRAM from 0x8000 to 0x9fff, one further on every pass, so
+ * no two frames come out the same. */
+static const uint8_t loop[] = {
+  0x21, 0x00, 0x80, /* ld hl, 0x8000 */
+  0x04,             /* inc b */
+  0x78,             /* ld a, b */
+  0x22,             /* ld (hl+), a */
+  0x7c,             /* ld a, h */
+  0xfe, 0xa0,       /* cp 0xa0 */
+  0x20, 0xf8,       /* jr nz, -8 */
+  0x26, 0x80,       /* ld h, 0x80 */
+  0x04,             /* inc b */
+  0x18, 0xf3        /* jr -13 */
+};
+
+static uint8_t  script[FRAMES];
+static uint32_t plain[FRAMES];
+static uint32_t shown[FRAMES];
+
+static uint32_t frame_hash(const uint16_t *pixels) {
+  return hash_fnv(HASH_INIT, pixels, 160 * 144 * sizeof *pixels);
+}
+
+static void make_script(void) {
+  uint32_t seed = 12345;
+  int      i = 0;
+  
+  while(i < FRAMES) {
+    uint8_t buttons;
+    int     n;
+    
+    seed    = seed * 1103515245u + 12345;
+    buttons = held[(seed >> 16) % sizeof held];
+    seed    = seed * 1103515245u + 12345;
+    for(n = 4 + (seed >> 16) % 32; n && (i < FRAMES); --n) script[i++] = buttons;
+  }
+}
+
+static void pause_for_display(void) {
+  struct timespec ts = { 0, IDLE_US * 1000 };
+  nanosleep(&ts, NULL);
+}
+
+static rom_t *vram_rom(void) {
+  static uint8_t image[0x8000];
+  
+  memcpy(&image[0x100], loop, sizeof loop);
+  return rom_create(NULL, image, sizeof image);
+}
+
+static gb_t *instance(rom_t *rom, uint16_t *pixels) {
+  gb_t *gb = calloc(1, sizeof *gb);
+  
+  if(!gb || !cart_load(gb, rom)) {
+    fprintf(stderr, "bench_speculate: out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  gb_set_framebuffer(gb, pixels, 160);
+  gb_init(gb);
+  gb_set_render_mode(gb, GB_RENDER_DEFERRED);
+  apu_enable(gb, 0);
+  return gb;
+}
+
+static void report(const char *name, double total, double worst) {
+  printf("  %-12s %7.1f us a frame on average, %7.1f at worst\n", name,
+    total / FRAMES * 1e6, worst * 1e6);
+}
+
+int main(int argc, char **argv) {
+  rom_t       *rom    = (argc > 1) ? rom_open(argv[1]) : vram_rom();
+  uint16_t    *pixels = calloc(160 * 144, sizeof *pixels);
+  runahead_t   ra;
+  speculate_t  sp;
+  gb_t        *gb;
+  double       total, worst, start, t;
+  int          i, n, steady = 0, late = 0, differ = 0;
+  
+  if(!rom || !pixels) {
+    fprintf(stderr, "bench_speculate: can't load %s\n", (argc > 1) ? argv[1] : "the built-in ROM");
+    return EXIT_FAILURE;
+  }
+  make_script();
+  printf("%s, %d frames, %d ahead, %d branches:\n",
+    (argc > 1) ? argv[1] : "built-in ROM", FRAMES, AHEAD, BRANCHES);
+  
+  gb = instance(rom, pixels);
+  for(i = 0; i < FRAMES; ++i) {
+    joypad_set(gb, script[i]);
+    gb_run(gb);
+    plain[i] = frame_hash(pixels);
+  }
+  gb_release(gb);
+  free(gb);
+  
+  gb = instance(rom, pixels);
+  if(!runahead_init(&ra, gb, AHEAD))
+    return EXIT_FAILURE;
+  total = worst = 0;
+  for(i = 0; i < FRAMES; ++i) {
+    start = bench_now();
+    joypad_set(gb, script[i]);
+    runahead_run(&ra, gb);
+    t = bench_now() - start;
+    
+    total += t;
+    if(t > worst) worst = t;
+    shown[i] = frame_hash(pixels);
+    pause_for_display();
+    
+    for(n = 1; (n <= AHEAD) && (i + n < FRAMES) && (script[i + n] == script[i]); ++n)
+      ;
+    if(n > AHEAD) {
+      ++steady;
+      late += (shown[i] != plain[i + AHEAD]);
+    }
+  }
+  report("run-ahead", total, worst);
+  printf("  %d of %d frames with the buttons held differ from a plain run\n",
+    late, steady);
+  runahead_free(&ra);
+  gb_release(gb);
+  free(gb);
+  
+  gb = instance(rom, pixels);
+  if(!speculate_init(&sp, gb, BRANCHES, AHEAD))
+    return EXIT_FAILURE;
+  total = worst = 0;
+  for(i = 0; i < FRAMES; ++i) {
+    const uint16_t *frame;
+    
+    start = bench_now();
+    frame = speculate_frame(&sp, gb, script[i]);
+    t = bench_now() - start;
+    
+    total += t;
+    if(t > worst) worst = t;
+    differ += (frame_hash(frame) != shown[i]);
+    pause_for_display();
+  }
+  report("speculation", total, worst);
+  printf("  %u/%u guessed, %.1f us a frame waiting on branches; "
+         "%d frames differ from run-ahead\n", (unsigned)sp.hits,
+    (unsigned)sp.rounds - 1, sp.waited / FRAMES * 1e6, differ);
+  speculate_free(&sp);
+  gb_release(gb);
+  free(gb);
+  
+  rom_unref(rom);
+  free(pixels);
+  return (late || differ) ? EXIT_FAILURE : 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* Speed of savestates, raw and compressed, and how large they come out.
+ * Runs the ROM given, or without one a built-in loop that keeps changing
+ * WRAM, for a few seconds of game time first, so the state isn't just the
+ * one after boot. Also checks that a loaded state runs on exactly as the
+ * saved one did. */
+
+#include <nds.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apu.h"
+#include "bench.h"
+#include "cart.h"
+#include "gb.h"
+#include "hash.h"
+#include "rom.h"
+#include "state.h"
+
+#define WARMUP 300
+#define REPS   2000
+
+uint16_t VRAM_A[SCREEN_WIDTH * SCREEN_HEIGHT];
+int      sstep = 0;
+
+/* Hashes what the game can see, and the CPU registers. */
+static uint32_t machine_hash(gb_t *gb) {
+  uint32_t h = hash_fnv(HASH_INIT, gb->memory, sizeof gb->memory);
+  
+  h = hash_fnv(h, &gb->pc, sizeof gb->pc);
+  h = hash_fnv(h, &gb->sp, sizeof gb->sp);
+  h = hash_fnv(h, gb->af, sizeof gb->af);
+  return hash_fnv(h, gb->hl, sizeof gb->hl);
+}
+
+/* Times REPS saves and loads, returning the blob's size. */
+static size_t bench(gb_t *gb, uint8_t *buf, size_t size, int flags) {
+  double t_save, t_load, start;
+  size_t n = 0;
+  int    i;
+  
+  start = bench_now();
+  for(i = 0; i < REPS; ++i) n = state_save(gb, buf, size, flags);
+  t_save = (bench_now() - start) / REPS;
+  
+  start = bench_now();
+  for(i = 0; i < REPS; ++i)
+    if(!state_load(gb, buf, n)) {
+      fprintf(stderr, "bench_state: state didn't load\n");
+      exit(EXIT_FAILURE);
+    }
+  t_load = (bench_now() - start) / REPS;
+  
+  printf("  %-10s %7lu bytes  save %6.1f us  load %6.1f us\n",
+    (flags & STATE_COMPRESS) ? "compressed" : "raw", (unsigned long)n,
+    t_save * 1e6, t_load * 1e6);
+  return n;
+}
+
+int main(int argc, char **argv) {
+  gb_t    *gb     = calloc(1, sizeof *gb);
+  uint16_t *pixels = calloc(160 * 144, sizeof *pixels);
+  rom_t   *rom    = (argc > 1) ? rom_open(argv[1]) : bench_rom();
+  uint8_t *buf;
+  size_t   size, n;
+  uint32_t before, after;
+  double   start, plain, saving;
+  int      i;
+  
+  if(!gb || !pixels || !rom || !cart_load(gb, rom)) {
+    fprintf(stderr, "bench_state: can't load %s\n", (argc > 1) ? argv[1] : "the built-in ROM");
+    return EXIT_FAILURE;
+  }
+  rom_unref(rom);
+  
+  gb_set_framebuffer(gb, pixels, 160);
+  gb_init(gb);
+  gb_set_render_mode(gb, GB_RENDER_DEFERRED);
+  for(i = 0; i < WARMUP; ++i) gb_run(gb);
+  
+  size = state_size(gb);
+  buf  = malloc(size);
+  if(!buf)
+    return EXIT_FAILURE;
+  
+  printf("%s, after %d frames:\n", (argc > 1) ? argv[1] : "built-in ROM", WARMUP);
+  bench(gb, buf, size, 0);
+  bench(gb, buf, size, STATE_COMPRESS);
+  
+  /* A loaded state has to run on exactly like the one it was saved from. */
+  n = state_save(gb, buf, size, 0);
+  for(i = 0; i < 60; ++i) gb_run(gb);
+  before = machine_hash(gb);
+  state_load(gb, buf, n);
+  for(i = 0; i < 60; ++i) gb_run(gb);
+  after = machine_hash(gb);
+  printf("  60 frames after loading: %08x, %s\n", (unsigned)after,
+    (before == after) ? "as saved" : "DIFFERENT");
+  
+  /* What saving every frame costs, against frames alone. */
+  start = bench_now();
+  for(i = 0; i < 600; ++i) gb_run(gb);
+  plain = bench_now() - start;
+  
+  start = bench_now();
+  for(i = 0; i < 600; ++i) {
+    gb_run(gb);
+    state_save(gb, buf, size, 0);
+  }
+  saving = bench_now() - start;
+  
+  printf("  saving every frame: %.1f frames/s, against %.1f (%+.1f%%)\n",
+    600 / saving, 600 / plain, 100 * (saving - plain) / plain);
+  
+  gb_release(gb);
+  free(gb);
+  free(pixels);
+  free(buf);
+  return (before == after) ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,573 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <nds.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "apu.h"
+#include "bench.h"
+#include "frameskip.h"
+#include "gb.h"
+#include "joypad.h"
+#include "loader.h"
+#include "movie.h"
+#include "ratectl.h"
+#include "resample.h"
+#include "rewind.h"
+#include "runahead.h"
+#include "scale.h"
+#include "state.h"
+#include "z80.h"
+
+uint16_t VRAM_A[SCREEN_WIDTH * SCREEN_HEIGHT];
+int      sstep = 0;
+
+static gb_t machine;
+
+/* Frame skipping: at most max_skip frames in a row go unrendered. With a
+ * simulated clock, time advances by a fixed cost per emulated frame plus a
+ * fixed cost per rendered frame, in microseconds, instead of being read from
+ * the host. */
+static int      max_skip   = -1;
+static int      simulated  = 0;
+static uint32_t sim_frame  = 0;
+static uint32_t sim_render = 0;
+static uint32_t sim_now    = 0;
+
+/* Optional host-resolution RGBA output, fed line by line. */
+static scaler_t  scaler;
+static uint32_t *output = NULL;
+
+static void scale_hook(gb_t *gb, int ly, const uint16_t *pixels) {
+  scaler_line(&scaler, ly, pixels);
+}
+
+/* Sound: written to a WAV file, at the APU's rate or resampled to another,
+ * or not synthesized at all when muted. */
+static FILE        *wav      = NULL;
+static uint32_t     wav_len  = 0;
+static uint32_t     wav_rate = APU_RATE;
+static resampler_t  resampler;
+static int          muted    = 0;
+static int          threaded = 0;
+
+/* A simulated audio device, for trying rate control without sound hardware.
+ * The display refreshes at 60 Hz. Each refresh the device plays 1/60 s of
+ * sound at the output rate, its clock device_ppm off, from a buffer of
+ * DEVICE_DEPTH refreshes that rate control keeps half full. What it plays,
+ * gaps included, is what goes to the WAV file. */
+#define DEVICE_REFRESH 60
+#define DEVICE_DEPTH   4
+
+static int      device         = 0;
+static int      device_ppm     = 0;
+static int      control_ppm    = 5000;
+static int16_t *device_buf     = NULL;
+static int      device_size    = 0;
+static int      device_fill    = 0;
+static int      device_playing = 0;
+static double   device_due     = 0;
+static double   device_ratio   = 0;
+static uint32_t device_underruns = 0;
+static uint32_t device_dropped   = 0;
+
+/* Rewinding: every frame is captured into a ring of rewind_kb KB, with a
+ * keyframe every second, and the time it takes is kept apart. */
+static rewind_t rw;
+static size_t   rewind_kb   = 0;
+static double   rewind_time = 0;
+static double   run_time    = 0;
+
+/* Run-ahead: every displayed frame runs runahead_frames ahead. */
+static runahead_t ra;
+static int        runahead_frames = 0;
+
+/* Movies: a run is recorded to movie_out with scripted buttons, or played
+ * back from movie_in, mapped whole. */
+static movie_t     movie;
+static FILE       *movie_out = NULL;
+static const char *movie_in  = NULL;
+
+/* Writes a 16-bit stereo WAV header for len bytes of samples. */
+static void wav_header(uint32_t len) {
+  uint8_t h[44];
+  
+  memcpy(h, "RIFF....WAVEfmt ", 16);
+  h[16] = 16; h[17] = h[18] = h[19] = 0;
+  h[20] = 1;  h[21] = 0;
+  h[22] = 2;  h[23] = 0;
+  h[24] = wav_rate & 0xff; h[25] = (wav_rate >> 8) & 0xff;
+  h[26] = (wav_rate >> 16) & 0xff; h[27] = wav_rate >> 24;
+  h[28] = (wav_rate * 4) & 0xff; h[29] = ((wav_rate * 4) >> 8) & 0xff;
+  h[30] = ((wav_rate * 4) >> 16) & 0xff; h[31] = (wav_rate * 4) >> 24;
+  h[32] = 4;  h[33] = 0;
+  h[34] = 16; h[35] = 0;
+  memcpy(h + 36, "data", 4);
+  h[40] = len & 0xff; h[41] = (len >> 8) & 0xff;
+  h[42] = (len >> 16) & 0xff; h[43] = len >> 24;
+  h[4] = (len + 36) & 0xff; h[5] = ((len + 36) >> 8) & 0xff;
+  h[6] = ((len + 36) >> 16) & 0xff; h[7] = (len + 36) >> 24;
+  
+  fseek(wav, 0, SEEK_SET);
+  fwrite(h, 1, sizeof h, wav);
+  fseek(wav, 0, SEEK_END);
+}
+
+static void wav_write(const int16_t *samples, int n) {
+  if(wav) wav_len += fwrite(samples, 4, n, wav) * 4;
+}
+
+/* Hands n frames of sound to the device, or straight to the WAV file. */
+static void sound_out(const int16_t *samples, int n) {
+  if(!device) {
+    wav_write(samples, n);
+    return;
+  }
+  
+  if(n > device_size - device_fill) {
+    device_dropped += n - (device_size - device_fill);
+    n               = device_size - device_fill;
+  }
+  memcpy(device_buf + device_fill * 2, samples, n * 4);
+  device_fill += n;
+}
+
+/* One display refresh: rate control looks at the device's buffer, then the
+ * device plays its share, once it has been filled to the target. */
+static void device_refresh(void) {
+  static const int16_t silence[2] = { 0, 0 };
+  int32_t              ppm        = ratectl_update(device_fill);
+  int                  play, have;
+  
+  resampler_set_ratio(&resampler, device_ratio * (1 + ppm / 1e6));
+  
+  if(!device_playing && (device_fill < device_size / 2))
+    return;
+  device_playing = 1;
+  
+  device_due += wav_rate * (1 + device_ppm / 1e6) / DEVICE_REFRESH;
+  play        = (int)device_due;
+  device_due -= play;
+  
+  have = (play < device_fill) ? play : device_fill;
+  wav_write(device_buf, have);
+  memmove(device_buf, device_buf + have * 2, (device_fill - have) * 4);
+  device_fill -= have;
+  
+  if(have < play) {
+    ++device_underruns;
+    for(; have < play; ++have) wav_write(silence, 1);
+  }
+}
+
+/* Passes on whatever sound is ready. */
+static void drain_sound(void) {
+  int16_t samples[2048 * 2];
+  int     n;
+  
+  /* A WAV file or the device wants every sample, so don't let the sound
+   * worker fall far enough behind to drop any. */
+  if(wav || device) apu_sync(&machine);
+  
+  while((n = apu_pending(&machine)) > 0) {
+    n = apu_read(&machine, samples, (n < 2048) ? n : 2048);
+    if(!wav && !device)
+      continue;
+    
+    if(wav_rate == APU_RATE) {
+      sound_out(samples, n);
+      continue;
+    }
+    
+    resampler_write(&resampler, samples, n);
+    while((n = resampler_read(&resampler, samples, 2048)) > 0)
+      sound_out(samples, n);
+  }
+}
+
+/* Finishes presenting a frame: scaled output and sound. */
+static void end_frame(void) {
+  if(rewind_kb) {
+    double start = bench_now();
+    
+    rewind_push(&rw, &machine);
+    rewind_time += bench_now() - start;
+  }
+  
+  if(output) scaler_flush(&scaler);
+  drain_sound();
+  if(device) device_refresh();
+}
+
+static uint32_t host_clock(void) {
+  return (uint32_t)(uint64_t)(bench_now() * 1e6);
+}
+
+static uint32_t sim_clock(void) {
+  return sim_now;
+}
+
+static void print_frameskip(void) {
+  int i;
+  
+  printf("frameskip level %d, skipped %u/%u frames\n", frameskip_level(),
+    (unsigned)frameskip_stats.skipped_frames, (unsigned)frameskip_stats.frames);
+  
+  for(i = 0; i < FRAMESKIP_BUCKETS; ++i) {
+    if(frameskip_stats.histogram[i])
+      printf("  %2d%s ms: %u\n", i, (i == FRAMESKIP_BUCKETS - 1) ? "+" : " ",
+        (unsigned)frameskip_stats.histogram[i]);
+  }
+}
+
+static void print_sound(void) {
+  const apu_stats_t *stats = &machine.apu.stats;
+  
+  printf("sound queue %u writes at the last frame, peak %u, %u stalls; "
+         "%u frames dropped\n", (unsigned)stats->queued,
+    (unsigned)stats->queue_peak, (unsigned)stats->queue_stalls,
+    (unsigned)stats->dropped);
+  
+  if(!device)
+    return;
+  
+  printf("audio device: fill %u (%d-%d, average %.1f) of %d frames, "
+         "latency %.1f ms (max %.1f)\n", (unsigned)ratectl_stats.fill,
+    ratectl_stats.fill_min, ratectl_stats.fill_max,
+    (double)ratectl_stats.fill_total / ratectl_stats.updates, device_size,
+    ratectl_stats.latency_us / 1000.0, ratectl_stats.latency_max_us / 1000.0);
+  printf("  ratio adjusted %+d ppm, %u underruns, %u frames dropped\n",
+    (int)ratectl_stats.adjust_ppm, (unsigned)device_underruns,
+    (unsigned)device_dropped);
+}
+
+/* Buttons to record, like a game being played: nothing, right, right and
+ * A, left, and B, held for 4 to 35 frames. */
+static uint8_t script_next(void) {
+  static const uint8_t held[] = { 0x00, 0x10, 0x11, 0x20, 0x02 };
+  static uint32_t      seed   = 12345;
+  static uint8_t       buttons;
+  static int           left   = 0;
+  
+  if(!left) {
+    seed    = seed * 1103515245u + 12345;
+    buttons = held[(seed >> 16) % sizeof held];
+    seed    = seed * 1103515245u + 12345;
+    left    = 4 + (seed >> 16) % 32;
+  }
+  --left;
+  return buttons;
+}
+
+/* Runs a freshly loaded ROM for the given number of frames and returns the
+ * frames per second achieved. */
+static double run(const char *rom, int frames, gb_render_mode_t mode) {
+  gb_t  *gb = &machine;
+  double start;
+  int    i;
+  
+  memset(gb->memory, 0, sizeof gb->memory);
+  load_file(gb, rom);
+  gb_init(gb);
+  gb_set_render_mode(gb, mode);
+  if(muted) apu_enable(gb, 0);
+  apu_set_threaded(gb, threaded);
+  
+  if(device) {
+    device_fill    = 0;
+    device_playing = 0;
+    /* Frames are paced by the display, so a refresh's worth of sound is a
+     * Game Boy frame's worth of samples, 70224 dots of them. */
+    device_ratio   = resampler_ratio(&resampler) * DEVICE_REFRESH * 70224 / 4194304;
+    ratectl_init(wav_rate, device_size / 2, control_ppm);
+  }
+  
+  if(max_skip >= 0)
+    frameskip_init(simulated ? sim_clock : host_clock, 1000000, max_skip);
+  
+  if(rewind_kb && !rewind_init(&rw, gb, rewind_kb << 10, 60)) {
+    fprintf(stderr, "orchard-headless: out of memory for rewinding\n");
+    exit(EXIT_FAILURE);
+  }
+  
+  if(!runahead_init(&ra, gb, runahead_frames)) {
+    fprintf(stderr, "orchard-headless: out of memory for run-ahead\n");
+    exit(EXIT_FAILURE);
+  }
+  
+  if(movie_out && !movie_record(&movie, gb, movie_out)) {
+    fprintf(stderr, "orchard-headless: can't write the movie\n");
+    exit(EXIT_FAILURE);
+  }
+  
+  start = bench_now();
+  for(i = 0; i < frames; ++i) {
+    if(movie_out) joypad_set(gb, script_next());
+    
+    if(max_skip < 0) {
+      runahead_run(&ra, gb);
+      end_frame();
+      continue;
+    }
+    
+    if(frameskip_begin()) {
+      gb_queue_render_mode(gb, mode);
+      sim_now += sim_render;
+    }
+    else {
+      gb_queue_render_mode(gb, GB_RENDER_NONE);
+    }
+    
+    runahead_run(&ra, gb);
+    end_frame();
+    sim_now += sim_frame;
+    frameskip_end();
+  }
+  
+  /* Let a threaded renderer finish its last frame, and the sound worker
+   * its last samples. */
+  gb_frame_changed(gb);
+  apu_sync(gb);
+  drain_sound();
+  
+  run_time = bench_now() - start;
+  runahead_free(&ra);
+  
+  if(movie_out && !movie_stop(&movie, gb)) {
+    fprintf(stderr, "orchard-headless: can't write the movie\n");
+    exit(EXIT_FAILURE);
+  }
+  return frames / run_time;
+}
+
+/* Plays a movie back as fast as it goes, without pixels, and reports the
+ * frames per second and whether it ended in the state recorded. */
+static void play(const char *rom, const char *path) {
+  gb_t        *gb = &machine;
+  struct stat  st;
+  void        *data;
+  double       start, took;
+  int          fd, frames, i, same;
+  
+  if(((fd = open(path, O_RDONLY)) < 0) || fstat(fd, &st) ||
+     ((data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+    fprintf(stderr, "orchard-headless: can't map %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  
+  memset(gb->memory, 0, sizeof gb->memory);
+  load_file(gb, rom);
+  gb_init(gb);
+  gb_set_render_mode(gb, GB_RENDER_NONE);
+  if(muted) apu_enable(gb, 0);
+  apu_set_threaded(gb, threaded);
+  
+  if(!movie_play(&movie, gb, data, st.st_size)) {
+    fprintf(stderr, "orchard-headless: %s isn't a movie of %s\n", path, rom);
+    exit(EXIT_FAILURE);
+  }
+  
+  /* A movie cut off plays until its last change of buttons. */
+  frames = movie.header.frames;
+  start  = bench_now();
+  for(i = 0; frames ? (i < frames) : movie.pending; ++i) {
+    gb_run(gb);
+    drain_sound();
+  }
+  apu_sync(gb);
+  drain_sound();
+  took = bench_now() - start;
+  
+  same = movie_stop(&movie, gb);
+  printf("played %d frames, %u changes of buttons, in %.3f s: %.1f frames/s\n",
+    i, (unsigned)movie.header.changes, took, i / took);
+  printf("  %s\n", !frames ? "cut off, so there is no end state to check" :
+    same ? "ends in the recorded state" : "ENDS IN ANOTHER STATE");
+  
+  munmap(data, st.st_size);
+  close(fd);
+}
+
+/* Reports what capturing cost and what the ring holds, then steps back
+ * through all of it, and checks that running forward again ends where the
+ * run did. */
+static void print_rewind(int frames) {
+  gb_t    *gb    = &machine;
+  size_t   size  = state_size(gb);
+  uint8_t *end   = malloc(size);
+  uint8_t *again = malloc(size);
+  size_t   n;
+  double   start, back;
+  int      held  = rw.count, steps = 0, i;
+  
+  printf("rewind: %d frames (%.1f s) in %lu KB, %u keyframes, %lu frames dropped\n",
+    held, held / 59.73, (unsigned long)(rw.used >> 10), (unsigned)rw.keys,
+    (unsigned long)rw.evicted);
+  printf("  %.0f bytes a frame, captured in %.1f us (%.1f%% of the run)\n",
+    (double)rw.used / held, rewind_time / frames * 1e6, 100 * rewind_time / run_time);
+  
+  if(!end || !again)
+    return;
+  n = state_save(gb, end, size, 0);
+  
+  start = bench_now();
+  while(rewind_pop(&rw, gb)) ++steps;
+  back = bench_now() - start;
+  if(steps)
+    printf("  stepped back %d frames in %.1f us each\n", steps, back / steps * 1e6);
+  
+  for(i = 0; i < steps; ++i) gb_run(gb);
+  printf("  running them again %s\n",
+    ((state_save(gb, again, size, 0) == n) && !memcmp(end, again, n)) ?
+    "ends in the same state" : "ENDS IN ANOTHER STATE");
+  
+  free(end);
+  free(again);
+}
+
+static void usage(void) {
+  fprintf(stderr,
+    "usage: orchard-headless [-f frames] [-n | -t | -b] [-k n [-s us,us]] [-o | -O WxH]\n"
+    "                        [-w file.wav] [-r rate [-d ppm[,max]]] [-m] [-a]\n"
+    "                        [-R kb] [-A n] [-M file | -P file] rom.gb\n"
+    "  -f n      run n frames (default 3600)\n"
+    "  -n        logic only; don't render pixels\n"
+    "  -t        render on a worker thread\n"
+    "  -b        benchmark with and without pixels\n"
+    "  -k n      skip rendering of up to n frames in a row when behind\n"
+    "  -s e,r    simulate the clock: e us per frame, r more per rendered one\n"
+    "  -o WxH    also scale output to W x H RGBA as lines are rendered\n"
+    "  -O WxH    the same, by the largest whole factor that fits, centred\n"
+    "  -w file   write sound to a WAV file\n"
+    "  -r rate   resample sound to rate Hz\n"
+    "  -d p,m    play through a simulated audio device p ppm fast, with rate\n"
+    "            control of up to m ppm (default 5000; 0 turns it off)\n"
+    "  -m        don't synthesize sound\n"
+    "  -a        synthesize sound on a worker thread\n"
+    "  -R kb     capture every frame for rewinding in kb KB, then rewind\n"
+    "  -A n      run n frames ahead of every displayed frame\n"
+    "  -M file   record a movie of the run, with scripted buttons\n"
+    "  -P file   play a movie back without pixels, as fast as it goes\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  gb_render_mode_t mode   = GB_RENDER_DEFERRED;
+  int              frames = 3600;
+  int              bench  = 0;
+  int              i;
+  
+  for(i = 1; i < argc - 1; ++i) {
+    if(!strcmp(argv[i], "-f") && (i + 1 < argc - 1)) frames = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "-n"))                  mode   = GB_RENDER_NONE;
+    else if(!strcmp(argv[i], "-t"))                  mode   = GB_RENDER_THREADED;
+    else if(!strcmp(argv[i], "-b"))                  bench  = 1;
+    else if(!strcmp(argv[i], "-k") && (i + 1 < argc - 1)) max_skip = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "-s") && (i + 1 < argc - 1) &&
+            (sscanf(argv[++i], "%u,%u", &sim_frame, &sim_render) == 2)) simulated = 1;
+    else if((!strcmp(argv[i], "-o") || !strcmp(argv[i], "-O")) && (i + 1 < argc - 1)) {
+      int whole = (argv[i][1] == 'O');
+      int w, h;
+      
+      if((sscanf(argv[++i], "%dx%d", &w, &h) != 2) ||
+         !(output = malloc(sizeof *output * w * h)) ||
+         !(whole ? scaler_init_integer : scaler_init)(&scaler, output, w, w, h))
+        usage();
+      gb_set_line_hook(&machine, scale_hook);
+    }
+    else if(!strcmp(argv[i], "-w") && (i + 1 < argc - 1)) {
+      if(!(wav = fopen(argv[++i], "wb")))
+        usage();
+      wav_header(0);
+    }
+    else if(!strcmp(argv[i], "-r") && (i + 1 < argc - 1)) {
+      wav_rate = atoi(argv[++i]);
+      if(!resampler_init(&resampler, 32, APU_RATE, wav_rate))
+        usage();
+    }
+    else if(!strcmp(argv[i], "-d") && (i + 1 < argc - 1) &&
+            (sscanf(argv[++i], "%d,%d", &device_ppm, &control_ppm) >= 1)) device = 1;
+    else if(!strcmp(argv[i], "-m")) muted    = 1;
+    else if(!strcmp(argv[i], "-a")) threaded = 1;
+    else if(!strcmp(argv[i], "-R") && (i + 1 < argc - 1)) rewind_kb = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "-A") && (i + 1 < argc - 1)) runahead_frames = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "-M") && (i + 1 < argc - 1)) {
+      if(!(movie_out = fopen(argv[++i], "wb")))
+        usage();
+    }
+    else if(!strcmp(argv[i], "-P") && (i + 1 < argc - 1)) movie_in = argv[++i];
+    else usage();
+  }
+  
+  /* Movies count every sample of the buttons, so no frame may run twice. */
+  if((argc < 2) || (frames <= 0) || (device && (wav_rate == APU_RATE)) ||
+     ((movie_out || movie_in) && (bench || rewind_kb || runahead_frames)) ||
+     (movie_out && movie_in))
+    usage();
+  
+  if(device) {
+    device_size = wav_rate / DEVICE_REFRESH * DEVICE_DEPTH;
+    device_buf  = malloc(device_size * 4);
+  }
+  
+  if(bench) {
+    double with    = run(argv[argc-1], frames, GB_RENDER_DEFERRED);
+    double without = run(argv[argc-1], frames, GB_RENDER_NONE);
+    
+    printf("%d frames\n", frames);
+    printf("  with pixels:    %8.1f frames/s\n", with);
+    printf("  without pixels: %8.1f frames/s\n", without);
+    return 0;
+  }
+  
+  if(movie_in) {
+    play(argv[argc-1], movie_in);
+  }
+  else {
+    printf("%.1f frames/s\n", run(argv[argc-1], frames, mode));
+    if(max_skip >= 0) print_frameskip();
+  }
+  if(!muted) print_sound();
+  if(rewind_kb) print_rewind(frames);
+  
+  if(movie_out) {
+    printf("movie: %u frames, %u changes of buttons, %ld bytes\n",
+      (unsigned)movie.header.frames, (unsigned)movie.header.changes, ftell(movie_out));
+    fclose(movie_out);
+  }
+  
+  if(wav) {
+    wav_header(wav_len);
+    fclose(wav);
+  }
+  return 0;
+}
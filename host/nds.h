@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/* A minimal stand-in for the parts of libnds the emulator core uses, so the
+ * core can be built on a host for headless runs. The framebuffer lives in
+ * ordinary memory, defined by the host front end. */
+
+#ifndef ORCHARD_HOST_NDS_H_
+#define ORCHARD_HOST_NDS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SCREEN_WIDTH  256
+#define SCREEN_HEIGHT 192
+
+#define RGB15(r, g, b) ((r) | ((g) << 5) | ((b) << 10))
+
+#define iprintf printf
+
+#define KEY_A (1 << 0)
+#define KEY_B (1 << 1)
+
+extern uint16_t VRAM_A[SCREEN_WIDTH * SCREEN_HEIGHT];
+
+static inline void     scanKeys      (void) { }
+static inline uint32_t keysDown      (void) { return 0; }
+static inline uint32_t keysDownRepeat(void) { return 0; }
+
+#endif
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "pool.h"
+
+/* The worker running on this thread, if any, so tasks push to their own
+ * deque. */
+static __thread pool_worker_t *self = NULL;
+
+/* Adds a task at the owner's end, growing the deque when it is over half
+ * full and sliding it down otherwise. */
+static int pool_deque_push(pool_worker_t *w, pool_task_t task, void *arg) {
+  pthread_mutex_lock(&w->lock);
+  
+  if(w->tail == w->size) {
+    int used = w->tail - w->head;
+    
+    if(used * 2 >= w->size) {
+      int          size  = w->size ? w->size * 2 : 64;
+      pool_item_t *items = realloc(w->items, size * sizeof *items);
+      
+      if(!items) {
+        pthread_mutex_unlock(&w->lock);
+        return 0;
+      }
+      w->items = items;
+      w->size  = size;
+    }
+    memmove(w->items, w->items + w->head, used * sizeof *w->items);
+    w->head = 0;
+    w->tail = used;
+  }
+  
+  w->items[w->tail].task = task;
+  w->items[w->tail].arg  = arg;
+  ++w->tail;
+  
+  pthread_mutex_unlock(&w->lock);
+  return 1;
+}
+
+/* Takes the newest task, for the owner, or the oldest, for a thief. */
+static int pool_deque_take(pool_worker_t *w, pool_item_t *item, int oldest) {
+  int found = 0;
+  
+  pthread_mutex_lock(&w->lock);
+  if(w->head != w->tail) {
+    *item = oldest ? w->items[w->head++] : w->items[--w->tail];
+    found = 1;
+  }
+  pthread_mutex_unlock(&w->lock);
+  
+  return found;
+}
+
+/* Tries every other worker once, starting from a random one. */
+static int pool_steal(pool_worker_t *w, pool_item_t *item) {
+  pool_t *pool = w->pool;
+  int     me   = w - pool->workers;
+  int     i, start;
+  
+  w->seed ^= w->seed << 13;
+  w->seed ^= w->seed >> 17;
+  w->seed ^= w->seed << 5;
+  start    = w->seed % pool->threads;
+  
+  for(i = 0; i < pool->threads; ++i) {
+    int victim = (start + i) % pool->threads;
+    
+    if((victim != me) && pool_deque_take(&pool->workers[victim], item, 1)) {
+      ++w->steals;
+      return 1;
+    }
+  }
+  
+  return 0;
+}
+
+/* Wakes every idle worker, to look for a task or to finish. */
+static void pool_wake(pool_t *pool, int pushed) {
+  pthread_mutex_lock(&pool->lock);
+  if(pushed) __atomic_add_fetch(&pool->pushes, 1, __ATOMIC_SEQ_CST);
+  pthread_cond_broadcast(&pool->cond);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/* Runs tasks until none are left anywhere. A worker that finds nothing
+ * while others are still running waits for them, since their tasks may
+ * push more: it sleeps until there has been a push since it started
+ * looking, or until the last task finishes. */
+static void *pool_main(void *arg) {
+  pool_worker_t *w    = arg;
+  pool_t        *pool = w->pool;
+  int            done = 0;
+  
+  self = w;
+  
+  while(!done) {
+    uint32_t    seen = __atomic_load_n(&pool->pushes, __ATOMIC_SEQ_CST);
+    pool_item_t item;
+    
+    if(pool_deque_take(w, &item, 0) || pool_steal(w, &item)) {
+      double start = bench_now();
+      
+      item.task(item.arg);
+      w->busy += bench_now() - start;
+      ++w->tasks;
+      if(!__atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST))
+        pool_wake(pool, 0);
+      continue;
+    }
+    
+    pthread_mutex_lock(&pool->lock);
+    while(__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST) && (pool->pushes == seen))
+      pthread_cond_wait(&pool->cond, &pool->lock);
+    done = !__atomic_load_n(&pool->pending, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pool->lock);
+  }
+  
+  self = NULL;
+  return NULL;
+}
+
+/* Sets up threads workers, or one per core the process may run on if
+ * threads is 0. Worker i is pinned to the i-th of those cores, wrapping
+ * around when there are more workers than cores. Returns 0 if memory runs
+ * out. */
+int pool_init(pool_t *pool, int threads) {
+  cpu_set_t cpus;
+  int       cpu_list[CPU_SETSIZE];
+  int       cpu_count = 0;
+  int       i;
+  
+  if(!sched_getaffinity(0, sizeof cpus, &cpus)) {
+    for(i = 0; i < CPU_SETSIZE; ++i)
+      if(CPU_ISSET(i, &cpus)) cpu_list[cpu_count++] = i;
+  }
+  
+  if(threads <= 0)
+    threads = cpu_count ? cpu_count : 1;
+  
+  memset(pool, 0, sizeof *pool);
+  pool->threads = threads;
+  pool->workers = calloc(threads, sizeof *pool->workers);
+  if(!pool->workers)
+    return 0;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->cond, NULL);
+  
+  for(i = 0; i < threads; ++i) {
+    pool_worker_t *w = &pool->workers[i];
+    
+    pthread_mutex_init(&w->lock, NULL);
+    w->seed = 0x9e3779b9u * (i + 1);
+    w->cpu  = cpu_count ? cpu_list[i % cpu_count] : -1;
+    w->pool = pool;
+  }
+  
+  return 1;
+}
+
+/* Queues a task: on the calling worker's own deque from inside a task, and
+ * round robin across the workers from outside. Returns 0 if memory runs
+ * out. */
+int pool_push(pool_t *pool, pool_task_t task, void *arg) {
+  pool_worker_t *w = (self && (self->pool == pool)) ? self :
+                     &pool->workers[pool->next++ % pool->threads];
+  
+  __atomic_add_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+  if(pool_deque_push(w, task, arg)) {
+    pool_wake(pool, 1);
+    return 1;
+  }
+  
+  __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_SEQ_CST);
+  return 0;
+}
+
+/* Runs every queued task, and every task they push, on the workers, and
+ * returns once all are done. */
+void pool_run(pool_t *pool) {
+  int i;
+  
+  for(i = 0; i < pool->threads; ++i) {
+    pool_worker_t  *w = &pool->workers[i];
+    pthread_attr_t  attr;
+    
+    pthread_attr_init(&attr);
+    if(w->cpu >= 0) {
+      cpu_set_t cpus;
+      
+      CPU_ZERO(&cpus);
+      CPU_SET(w->cpu, &cpus);
+      pthread_attr_setaffinity_np(&attr, sizeof cpus, &cpus);
+    }
+    pthread_create(&w->thread, &attr, pool_main, w);
+    pthread_attr_destroy(&attr);
+  }
+  
+  for(i = 0; i < pool->threads; ++i)
+    pthread_join(pool->workers[i].thread, NULL);
+}
+
+void pool_free(pool_t *pool) {
+  int i;
+  
+  for(i = 0; i < pool->threads; ++i) {
+    pthread_mutex_destroy(&pool->workers[i].lock);
+    free(pool->workers[i].items);
+  }
+  free(pool->workers);
+  pool->workers = NULL;
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->cond);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_HOST_POOL_H_
+#define ORCHARD_HOST_POOL_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+/* A work-stealing thread pool for running many independent jobs, one thread
+ * pinned to each core. Every worker has its own deque: it takes the newest
+ * task from its own end and, when that runs dry, steals the oldest from
+ * another worker's. Tasks are whole emulator runs, so each deque has a plain
+ * mutex; it is taken a few times per task, not per instruction. Tasks may
+ * push more tasks. A worker that finds nothing to do sleeps until a task is
+ * pushed or the last one finishes. */
+
+typedef void (*pool_task_t)(void *arg);
+
+typedef struct {
+  pool_task_t task;
+  void       *arg;
+} pool_item_t;
+
+typedef struct {
+  pthread_mutex_t lock;
+  pool_item_t    *items;
+  int             head;      /* Oldest task, where thieves take from. */
+  int             tail;      /* One past the newest, where the owner works. */
+  int             size;
+  uint32_t        seed;      /* Picks whom to steal from. */
+  
+  /* Statistics. */
+  uint32_t        tasks;     /* Tasks run. */
+  uint32_t        steals;    /* Of which were taken from another worker. */
+  double          busy;      /* Seconds spent running them. */
+  
+  pthread_t       thread;
+  int             cpu;       /* Pinned to, or -1. */
+  struct pool    *pool;
+} pool_worker_t;
+
+typedef struct pool {
+  int             threads;
+  pool_worker_t  *workers;
+  int             pending;   /* Pushed and not yet finished. */
+  int             next;      /* Gets the next task pushed from outside. */
+  
+  /* Where idle workers wait. pushes counts every push, so a worker can
+   * tell whether one came while it was looking. */
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  uint32_t        pushes;
+} pool_t;
+
+int  pool_init(pool_t *pool, int threads);
+int  pool_push(pool_t *pool, pool_task_t task, void *arg);
+void pool_run (pool_t *pool);
+void pool_free(pool_t *pool);
+
+#endif
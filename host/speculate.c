@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "apu.h"
+#include "bench.h"
+#include "bgcache.h"
+#include "cart.h"
+#include "gb.h"
+#include "joypad.h"
+#include "speculate.h"
+#include "state.h"
+
+/* Runs the real frame from a state with the branch's guess, saves where it
+ * ends up, then runs ahead and draws the last frame. Rendering starts at
+ * the VBlank where that frame does, as runahead_run() has it. */
+static void speculate_run(speculate_t *sp, speculate_branch_t *b,
+                          const uint8_t *state, size_t len) {
+  gb_t *gb = b->gb;
+  int   i;
+  
+  state_load(gb, state, len);
+  joypad_set(gb, b->input);
+  gb_set_render_mode(gb, sp->frames ? GB_RENDER_NONE : GB_RENDER_DEFERRED);
+  if(sp->frames == 1) gb_queue_render_mode(gb, GB_RENDER_DEFERRED);
+  gb_run(gb);
+  b->after_len = state_save(gb, b->after, sp->size, 0);
+  
+  for(i = 1; i <= sp->frames; ++i) {
+    if(i == sp->frames - 1) gb_queue_render_mode(gb, GB_RENDER_DEFERRED);
+    if(i == sp->frames)     gb_set_render_mode(gb, GB_RENDER_DEFERRED);
+    gb_run(gb);
+  }
+}
+
+static void *speculate_main(void *arg) {
+  speculate_branch_t *b  = arg;
+  speculate_t        *sp = b->sp;
+  
+  pthread_mutex_lock(&b->lock);
+  for(;;) {
+    while(!b->busy && !b->quit)
+      pthread_cond_wait(&b->cond, &b->lock);
+    if(b->quit)
+      break;
+    pthread_mutex_unlock(&b->lock);
+    
+    speculate_run(sp, b, sp->state[sp->cur], sp->len[sp->cur]);
+    
+    pthread_mutex_lock(&b->lock);
+    b->busy = 0;
+    pthread_cond_broadcast(&b->cond);
+  }
+  pthread_mutex_unlock(&b->lock);
+  return NULL;
+}
+
+static void speculate_wait(speculate_branch_t *b) {
+  pthread_mutex_lock(&b->lock);
+  while(b->busy)
+    pthread_cond_wait(&b->cond, &b->lock);
+  pthread_mutex_unlock(&b->lock);
+}
+
+/* Moves the buttons to the front of those seen recently. */
+static void speculate_seen(speculate_t *sp, uint8_t input) {
+  int i;
+  
+  for(i = 0; (i < sp->recent_count) && (sp->recent[i] != input); ++i)
+    ;
+  if(i == sp->recent_count) {
+    if(i == SPECULATE_RECENT) --i;
+    else ++sp->recent_count;
+  }
+  memmove(sp->recent + 1, sp->recent, i);
+  sp->recent[0] = input;
+}
+
+/* Starts a round from the state in state[cur], with a branch for each of
+ * the buttons seen recently. */
+static void speculate_launch(speculate_t *sp) {
+  int i;
+  
+  for(i = 0; i < sp->count; ++i) {
+    speculate_branch_t *b = &sp->branches[i];
+    
+    b->active = (i < sp->recent_count);
+    if(!b->active)
+      continue;
+    
+    b->input = sp->recent[i];
+    pthread_mutex_lock(&b->lock);
+    b->busy = 1;
+    pthread_cond_broadcast(&b->cond);
+    pthread_mutex_unlock(&b->lock);
+  }
+  
+  sp->running = 1;
+  ++sp->rounds;
+}
+
+/* Sets up an instance like gb, on the same cartridge, that is silent, draws
+ * to pixels and keeps no background cache, as every frame starts with a
+ * state load. */
+static int speculate_branch(speculate_t *sp, speculate_branch_t *b, gb_t *gb,
+                            uint16_t *pixels) {
+  b->sp     = sp;
+  b->gb     = calloc(1, sizeof *b->gb);
+  b->pixels = pixels;
+  b->after  = malloc(sp->size);
+  if(!b->gb || !b->pixels || !b->after || !cart_load(b->gb, gb->cart.rom))
+    return 0;
+  
+  gb_set_framebuffer(b->gb, b->pixels, 160);
+  gb_init(b->gb);
+  apu_enable(b->gb, 0);
+  bgcache_enable(b->gb, 0);
+  return 1;
+}
+
+/* Sets up branches, each on a thread, running frames ahead of the real
+ * frame as runahead.h does. The instance no longer draws: the frame to show
+ * comes from speculate_frame(). Returns 0 if memory runs out. */
+int speculate_init(speculate_t *sp, gb_t *gb, int branches, int frames) {
+  int i;
+  
+  memset(sp, 0, sizeof *sp);
+  sp->count    = (branches > 0) ? branches : 1;
+  sp->frames   = (frames > 0) ? frames : 0;
+  sp->size     = state_size(gb);
+  sp->state[0] = malloc(sp->size);
+  sp->state[1] = malloc(sp->size);
+  sp->pixels   = calloc(160 * 144, sizeof *sp->pixels);
+  sp->branches = calloc(sp->count, sizeof *sp->branches);
+  if(!sp->state[0] || !sp->state[1] || !sp->pixels || !sp->branches)
+    goto fail;
+  
+  if(!speculate_branch(sp, &sp->spare, gb, sp->pixels))
+    goto fail;
+  for(i = 0; i < sp->count; ++i) {
+    speculate_branch_t *b = &sp->branches[i];
+    
+    if(!speculate_branch(sp, b, gb, calloc(160 * 144, sizeof *b->pixels)))
+      goto fail;
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->cond, NULL);
+    pthread_create(&b->thread, NULL, speculate_main, b);
+    b->started = 1;
+  }
+  
+  gb_set_render_mode(gb, GB_RENDER_NONE);
+  speculate_seen(sp, 0);
+  return 1;
+  
+fail:
+  speculate_free(sp);
+  return 0;
+}
+
+/* Runs the real frame with the buttons held for it and returns the frame
+ * to show, which stays put until the next call. The round for the next
+ * frame is under way when this returns. */
+const uint16_t *speculate_frame(speculate_t *sp, gb_t *gb, uint8_t input) {
+  speculate_branch_t *hit  = NULL;
+  int                 prev = sp->cur;
+  double              start;
+  int                 i;
+  
+  if(!sp->running) {
+    sp->len[prev] = state_save(gb, sp->state[prev], sp->size, 0);
+    speculate_launch(sp);
+  }
+  
+  start = bench_now();
+  for(i = 0; i < sp->count; ++i) {
+    speculate_branch_t *b = &sp->branches[i];
+    
+    speculate_wait(b);
+    if(b->active && (b->input == input)) hit = b;
+  }
+  sp->waited += bench_now() - start;
+  
+  speculate_seen(sp, input);
+  joypad_set(gb, input);
+  sp->cur = !prev;
+  
+  /* The branch ended the real frame where the instance is about to, so
+   * the next round can start from its state while the instance gets
+   * there itself. */
+  if(hit) {
+    ++sp->hits;
+    memcpy(sp->pixels, hit->pixels, 160 * 144 * sizeof *sp->pixels);
+    memcpy(sp->state[sp->cur], hit->after, hit->after_len);
+    sp->len[sp->cur] = hit->after_len;
+    speculate_launch(sp);
+    gb_run(gb);
+    return sp->pixels;
+  }
+  
+  /* Within a frame of the real one, the next frame shown starts before the
+   * real frame ends, and the instance captures those lines without
+   * rendering; the spare's state has them captured for drawing, so the next
+   * round waits for it. Further ahead, it starts from the instance's. */
+  sp->spare.input = input;
+  if(sp->frames < 2) {
+    speculate_run(sp, &sp->spare, sp->state[prev], sp->len[prev]);
+    memcpy(sp->state[sp->cur], sp->spare.after, sp->spare.after_len);
+    sp->len[sp->cur] = sp->spare.after_len;
+    speculate_launch(sp);
+    gb_run(gb);
+    return sp->pixels;
+  }
+  
+  gb_run(gb);
+  sp->len[sp->cur] = state_save(gb, sp->state[sp->cur], sp->size, 0);
+  speculate_launch(sp);
+  speculate_run(sp, &sp->spare, sp->state[prev], sp->len[prev]);
+  return sp->pixels;
+}
+
+/* Ends the threads and releases the branches. */
+void speculate_free(speculate_t *sp) {
+  int i;
+  
+  for(i = 0; sp->branches && (i < sp->count); ++i) {
+    speculate_branch_t *b = &sp->branches[i];
+    
+    if(b->started) {
+      pthread_mutex_lock(&b->lock);
+      while(b->busy)
+        pthread_cond_wait(&b->cond, &b->lock);
+      b->quit = 1;
+      pthread_cond_broadcast(&b->cond);
+      pthread_mutex_unlock(&b->lock);
+      pthread_join(b->thread, NULL);
+      pthread_mutex_destroy(&b->lock);
+      pthread_cond_destroy(&b->cond);
+    }
+    if(b->gb) gb_release(b->gb);
+    free(b->gb);
+    free(b->pixels);
+    free(b->after);
+  }
+  
+  if(sp->spare.gb) gb_release(sp->spare.gb);
+  free(sp->spare.gb);
+  free(sp->spare.after);
+  free(sp->branches);
+  free(sp->pixels);
+  free(sp->state[0]);
+  free(sp->state[1]);
+  sp->branches = NULL;
+  sp->pixels   = NULL;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_HOST_SPECULATE_H_
+#define ORCHARD_HOST_SPECULATE_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "z80.h"
+
+/* Speculation runs the frames run-ahead needs before the buttons for them
+ * are known. While the front end waits for the display, each branch, an
+ * instance of its own on a thread of its own, starts from the last real
+ * frame with one guess at the next buttons: the ones held now, then those
+ * held most recently before them. It runs the next frame, and as many as
+ * runahead.h would after it, drawing only the last. When the real buttons
+ * come, a branch that guessed them has the frame to show ready, and its
+ * state after the first frame starts the next round straight away; the
+ * instance itself only runs the real frame, without pixels, so the sound
+ * goes on unbroken. A miss works the frame out on the calling thread, as
+ * run-ahead would. */
+
+#define SPECULATE_RECENT 8
+
+typedef struct {
+  gb_t            *gb;
+  uint16_t        *pixels;    /* The frame it would show, 160 x 144. */
+  uint8_t         *after;     /* Its state after the first frame. */
+  size_t           after_len;
+  uint8_t          input;     /* The buttons it guessed. */
+  int              active;    /* Had a guess this round. */
+  
+  pthread_t        thread;
+  pthread_mutex_t  lock;
+  pthread_cond_t   cond;
+  int              started;
+  int              busy;
+  int              quit;
+  struct speculate *sp;
+} speculate_branch_t;
+
+typedef struct speculate {
+  int                 count;       /* Branches. */
+  int                 frames;      /* Run ahead of the real frame. */
+  speculate_branch_t *branches;
+  speculate_branch_t  spare;       /* Works out misses; has no thread. */
+  uint16_t           *pixels;      /* The frame shown. */
+  
+  uint8_t            *state[2];    /* Where rounds start, in turn. */
+  size_t              len[2];
+  size_t              size;
+  int                 cur;         /* The round out now. */
+  int                 running;
+  
+  uint8_t             recent[SPECULATE_RECENT];   /* Newest first. */
+  int                 recent_count;
+  
+  /* Statistics. */
+  uint32_t            rounds;
+  uint32_t            hits;
+  double              waited;      /* Seconds spent waiting on branches. */
+} speculate_t;
+
+int             speculate_init (speculate_t *sp, gb_t *gb, int branches, int frames);
+const uint16_t *speculate_frame(speculate_t *sp, gb_t *gb, uint8_t input);
+void            speculate_free (speculate_t *sp);
+
+#endif
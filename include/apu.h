@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_APU_H_
+#define ORCHARD_APU_H_
+
+#include <stdint.h>
+#ifdef ORCHARD_THREADS
+#include <pthread.h>
+#endif
+
+#include "z80.h"
+
+/* Samples per second produced by the synthesizer: one every 64 dots. */
+#define APU_RATE 65536
+
+/* Sound registers are handled as they are written, so reads and channel
+ * status are exact, but nothing is synthesized then. Writes are logged with
+ * their time and turned into samples in batches by apu_frame(), using
+ * band-limited steps, so the cost follows the number of waveform edges
+ * instead of the number of cycles. */
+
+/* With ORCHARD_THREADS the synthesizer can run on a worker thread instead.
+ * Logged writes then go through a lock-free single-producer queue, and the
+ * worker turns them into samples while emulation carries on. Reads of NR52
+ * and wave RAM never wait for it: the register side stays on the emulation
+ * thread. */
+
+typedef struct {
+  uint32_t queued;          /* Writes waiting at the last apu_frame(). */
+  uint32_t queue_peak;      /* Most writes ever waiting at once. */
+  uint32_t queue_stalls;    /* Times emulation waited for room. */
+  uint32_t underruns;       /* apu_read() calls that came up short, */
+  uint32_t underrun_frames; /* and by how many frames in all. */
+  uint32_t dropped;         /* Frames lost to a full output buffer. */
+} apu_stats_t;
+
+/* Sizes of the write log, in writes, of the synthesizer's block of steps,
+ * in samples, and of the output buffer, in stereo samples. */
+#define APU_QUEUE_SIZE 4096
+#define APU_BLIP_BLOCK 1024
+#define APU_BLIP_WIDTH 16
+#define APU_OUT_SIZE   8192
+
+/* A logged write: a register, or one of the pseudo-registers in apu.c. */
+typedef struct {
+  uint32_t time;
+  uint16_t value;
+  uint8_t  reg;
+} apu_event_t;
+
+/* Register side: lengths, envelopes and the sweep, which decide what NR52
+ * reads and what each channel's level is. Channel registers are 5 apart
+ * from 0xff10. */
+typedef struct {
+  uint8_t  enabled;
+  uint16_t length;
+  uint8_t  volume;
+  uint8_t  env_timer;
+  uint8_t  level;
+} apu_channel_t;
+
+/* Synthesizer side: oscillators driven only by the log. amp is a channel's
+ * current output, 0-15, and out_l/out_r what it contributes to the mix. */
+typedef struct {
+  uint32_t next;
+  uint32_t period;
+  uint8_t  pos;
+  uint8_t  amp;
+  uint8_t  level;
+  int      out_l, out_r;
+} apu_voice_t;
+
+/* Everything up to the queue starts over on reset. */
+typedef struct {
+  uint8_t       regs[0x30];
+  uint8_t       power;
+  uint8_t       synth_on;
+  uint8_t       held;
+  int           step;
+  apu_channel_t ch[4];
+  uint16_t      shadow;
+  uint8_t       sweep_timer;
+  uint8_t       sweep_on;
+  apu_stats_t   stats;
+  
+  /* Emulation adds at queue_head; the synthesizer takes from queue_tail. */
+  uint32_t      queue_head;
+  uint32_t      queue_tail;
+  apu_event_t   queue[APU_QUEUE_SIZE];
+  
+  struct {
+    uint8_t     regs[0x30];
+    apu_voice_t ch[4];
+    uint16_t    lfsr;
+    uint8_t     wave[32];
+    uint8_t     wave_shift;
+    int         vol_l, vol_r;
+    uint32_t    base;
+    int32_t     blip[2][APU_BLIP_BLOCK + APU_BLIP_WIDTH + 1];
+    int32_t     sum[2];
+    int32_t     dc[2];
+  } synth;
+  
+  /* The synthesizer adds at out_head; apu_read() takes from out_tail. */
+  int           out_head;
+  int           out_tail;
+  int16_t       out[APU_OUT_SIZE][2];
+  
+#ifdef ORCHARD_THREADS
+  /* The worker sleeps while the queue is empty. */
+  pthread_t       worker;
+  pthread_mutex_t worker_lock;
+  pthread_cond_t  worker_wake;
+  pthread_cond_t  worker_idle;
+  int             worker_started;
+  int             worker_on;
+  int             worker_busy;
+  int             worker_asleep;
+  int             worker_quit;
+#endif
+} apu_t;
+
+void apu_reset       (gb_t *gb);
+void apu_write       (gb_t *gb, uint16_t addr, uint8_t value);
+void apu_enable      (gb_t *gb, int enable);
+void apu_resume      (gb_t *gb);
+void apu_hold        (gb_t *gb, int hold);
+void apu_set_threaded(gb_t *gb, int threaded);
+void apu_frame       (gb_t *gb);
+void apu_step        (gb_t *gb);
+void apu_sync        (gb_t *gb);
+int  apu_pending     (gb_t *gb);
+int  apu_read        (gb_t *gb, int16_t *out, int frames);
+
+#endif
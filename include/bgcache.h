@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_BGCACHE_H_
+#define ORCHARD_BGCACHE_H_
+
+#include <stdint.h>
+#include "z80.h"
+
+/* The background cache keeps both tile maps pre-rendered as 256x256 bitmaps
+ * of color numbers, so drawing a background or window span is a wrapped copy
+ * instead of a tile walk. Entries are redrawn lazily when their map byte or
+ * the tile they reference changes. */
+
+typedef struct {
+  uint8_t  surface[2][256][256];
+  uint32_t map_dirty[2][1024/32];
+  uint32_t tile_dirty[384/32];
+  uint8_t  pending;
+  uint8_t  tiles_pending;
+  uint8_t  stale;
+  uint8_t  signed_data;
+  uint8_t  enabled;
+  uint8_t  active;
+  uint8_t  quiet;
+  uint32_t writes;
+} bgcache_t;
+
+void bgcache_reset  (gb_t *gb);
+void bgcache_enable (gb_t *gb, int enable);
+void bgcache_write  (gb_t *gb, uint16_t addr);
+void bgcache_lcdc   (gb_t *gb, uint8_t value);
+void bgcache_frame  (gb_t *gb);
+int  bgcache_active (gb_t *gb);
+void bgcache_span   (gb_t *gb, uint8_t *out, int n, uint16_t map, uint8_t x, uint8_t y);
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_CART_H_
+#define ORCHARD_CART_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "rom.h"
+#include "z80.h"
+
+/* The cartridge: a shared, read-only ROM image and the instance's own RAM.
+ * The memory bank controller switches banks by pointing pages 0-7 into the
+ * image and pages 0xa-0xb into the RAM, so nothing is copied and reads cost
+ * the same whatever is mapped. MBC3's clock isn't emulated, and MBC2's 512
+ * half-bytes act as ordinary RAM. A cartridge without RAM leaves
+ * 0xa000-0xbfff to instance memory, as before banking existed. */
+
+typedef enum {
+  CART_ROM,
+  CART_MBC1,
+  CART_MBC2,
+  CART_MBC3,
+  CART_MBC5
+} cart_mbc_t;
+
+typedef struct {
+  rom_t     *rom;
+  cart_mbc_t mbc;
+  uint8_t   *ram;          /* NULL for none. */
+  size_t     ram_size;
+  uint8_t    ram_enabled;
+  uint8_t    mode;         /* MBC1: bank 2's bits also switch 0x0000-0x3fff. */
+  uint16_t   bank;         /* ROM bank register(s). */
+  uint8_t    bank2;        /* MBC1's upper bits, or the RAM bank. */
+} cart_t;
+
+int  cart_load   (gb_t *gb, rom_t *rom);
+void cart_reset  (gb_t *gb);
+void cart_map    (gb_t *gb);
+void cart_write  (gb_t *gb, uint16_t addr, uint8_t value);
+void cart_release(gb_t *gb);
+
+#endif
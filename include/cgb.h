@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_CGB_H_
+#define ORCHARD_CGB_H_
+
+#include <stdint.h>
+#include "z80.h"
+
+/* Game Boy Color state. Banked memory is switched by pointing pages of
+ * the page tables at it; bank 0 of VRAM and bank 1 of WRAM stay in memory,
+ * where a DMG game finds them. */
+typedef struct {
+  int      enabled;        /* Running a CGB game in CGB mode. */
+  uint8_t  speed;          /* 1 in double-speed mode. */
+  uint8_t  vram_bank;
+  uint8_t  wram_bank;
+  
+  /* HBlank HDMA in progress. */
+  uint8_t  hdma_active;
+  uint8_t  hdma_blocks;    /* 16-byte blocks left. */
+  uint16_t hdma_src;
+  uint16_t hdma_dst;
+  
+  uint8_t  bg_pal[64];     /* 8 palettes of 4 little-endian BGR555 colors. */
+  uint8_t  obj_pal[64];
+  uint16_t lut[64];        /* Output colors: background 0-31, sprites 32-63. */
+  
+  uint8_t  vram1[0x2000];
+  uint8_t  wram[6][0x1000]; /* Banks 2-7. */
+} cgb_t;
+
+void cgb_init (gb_t *gb, int enabled);
+void cgb_map  (gb_t *gb);
+void cgb_write(gb_t *gb, uint16_t addr, uint8_t value);
+int  cgb_stop (gb_t *gb);
+void cgb_hblank(gb_t *gb);
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_FORK_H_
+#define ORCHARD_FORK_H_
+
+#include <stdint.h>
+#include "z80.h"
+
+/* Forked instances share memory copy on write, a 4 KB page at a time. The
+ * pages that can be shared are those only the CPU reaches, through the page
+ * tables: 0xa000-0xdfff, the CGB's other WRAM banks and the cartridge RAM,
+ * each a slot. Forking copies a slot into a page of its own once, which the
+ * parent and any number of children then map for reads only; the parent's
+ * own copy stays current and a child's goes stale. The first write to such
+ * a page finds no write mapping and lands in fork_write(), which gives the
+ * instance its memory back, copying the page first if it was stale, and
+ * drops its reference. VRAM, OAM and I/O are read by more than the CPU, so
+ * forks always copy them. */
+
+#define FORK_PAGE  0x1000
+#define FORK_SLOTS (4 + 6 + 32)   /* 0xa000-0xdfff, WRAM banks 2-7, and */
+                                  /* up to 128 KB of cartridge RAM. */
+
+typedef struct {
+  int     refs;
+  uint8_t data[FORK_PAGE];
+} fork_page_t;
+
+typedef struct {
+  fork_page_t *page[FORK_SLOTS];    /* The shared copy of each slot, if any. */
+  uint8_t      stale[FORK_SLOTS];   /* The instance's own copy is old. */
+  int8_t       slot_of[16];         /* The slot each page maps, or -1. */
+  int          held;                /* Slots with a shared copy. */
+  uint32_t     copies;              /* Pages copied on a first write. */
+} fork_t;
+
+int            fork_slots(gb_t *gb);
+uint8_t       *fork_own  (gb_t *gb, int slot);
+const uint8_t *fork_data (gb_t *gb, int slot);
+void           fork_share(gb_t *child, gb_t *parent, int slot);
+void           fork_map  (gb_t *gb, int page, const uint8_t **read, uint8_t **write);
+uint8_t       *fork_write(gb_t *gb, int page);
+void           fork_drop (gb_t *gb);
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_FRAMESKIP_H_
+#define ORCHARD_FRAMESKIP_H_
+
+#include <stdint.h>
+
+/* Frame times are binned by millisecond; the last bucket holds everything
+ * longer. */
+#define FRAMESKIP_BUCKETS 64
+
+/* A clock returning ticks; it may wrap around. */
+typedef uint32_t (*frameskip_clock_t)(void);
+
+typedef struct {
+  uint32_t frames;
+  uint32_t skipped_frames;
+  uint32_t histogram[FRAMESKIP_BUCKETS];
+} frameskip_stats_t;
+
+void frameskip_init (frameskip_clock_t clock, uint32_t ticks_per_sec, int max_skip);
+int  frameskip_begin(void);
+void frameskip_end  (void);
+int  frameskip_level(void);
+
+extern frameskip_stats_t frameskip_stats;
+
+#endif
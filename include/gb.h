@@ -27,10 +27,26 @@
 #define ORCHARD_GB_H_
 
 #include <stdint.h>
+#ifdef ORCHARD_THREADS
+#include <pthread.h>
+#endif
+
+#include "apu.h"
+#include "bgcache.h"
+#include "cart.h"
+#include "cgb.h"
+#include "fork.h"
+#include "joypad.h"
+#include "sched.h"
+#include "serial.h"
 #include "z80.h"
 
 /* Macros that expand to memory mapped registers. */
-#define MMAP(n) z80_memory[0xff00+n]
+#define MMAP(n) MEM(0xff00+n)
+
+/* Instance memory, from 0x8000 up. Everything below is the cartridge's. */
+#define MEM(addr) gb->memory[(addr) - 0x8000]
+#define P1   MMAP(0x00)
 #define TIMA MMAP(0x05)
 #define TMA  MMAP(0x06)
 #define TAC  MMAP(0x07)
@@ -64,14 +80,169 @@
 #define OBP1 MMAP(0x49)
 #define WY   MMAP(0x4a)
 #define WX   MMAP(0x4b)
+#define KEY1  MMAP(0x4d)
+#define VBK   MMAP(0x4f)
+#define HDMA1 MMAP(0x51)
+#define HDMA2 MMAP(0x52)
+#define HDMA3 MMAP(0x53)
+#define HDMA4 MMAP(0x54)
+#define HDMA5 MMAP(0x55)
+#define BCPS  MMAP(0x68)
+#define BCPD  MMAP(0x69)
+#define OCPS  MMAP(0x6a)
+#define OCPD  MMAP(0x6b)
+#define SVBK  MMAP(0x70)
 #define IE   MMAP(0xff)
 
-void gb_init(void);
-void gb_run(void);
-void gb_set_clock(void);
+/* Rendering statistics. Frames where every line matched what was already
+ * in the framebuffer count as skipped. */
+typedef struct {
+  uint32_t frames;
+  uint32_t skipped_frames;
+  uint32_t skipped_lines;
+} gb_stats_t;
+
+/* When captured lines are turned into pixels. */
+typedef enum {
+  GB_RENDER_INLINE,   /* As each line is reached. */
+  GB_RENDER_DEFERRED, /* In one batch at VBlank. */
+  GB_RENDER_THREADED, /* At VBlank, on a worker thread (ORCHARD_THREADS). */
+  GB_RENDER_NONE      /* Never; see gb_render_frame(). */
+} gb_render_mode_t;
+
+/* Receives each rendered line as 160 RGB15 pixels. */
+typedef void (*gb_line_hook_t)(gb_t *gb, int ly, const uint16_t *pixels);
+
+/* Registers that decide what a line looks like. */
+typedef struct {
+  uint8_t lcdc, scy, scx, wy, wx, bgp, obp0, obp1, window_line;
+} gb_line_regs_t;
+
+/* Renders one line; there is one per LCDC configuration. */
+typedef void (*gb_renderer_t)(gb_t *gb, const gb_line_regs_t *r, int ly);
+
+/* A captured line: its registers, the VRAM/OAM epoch it was seen in, and the
+ * renderer LCDC selected for it. */
+typedef struct {
+  gb_line_regs_t regs;
+  uint32_t       epoch;
+  gb_renderer_t  render;
+} gb_line_t;
+
+/* One Game Boy. Nothing in the core is global, so instances can run side by
+ * side, one per thread. Fields go from hot to cold: what every instruction
+ * touches comes first and shares a few cache lines, per-line and per-frame
+ * state follows, and the large buffers come last. An instance starts out
+ * zeroed, as a static or from calloc(); load_file() and gb_init() do the
+ * rest. */
+struct gb {
+  /* Every instruction: registers, timers, the scheduler and where the CPU
+   * reads and writes each 4 KB page. */
+  uint8_t          af[2], bc[2], de[2], hl[2];
+  uint16_t         sp, pc;
+  uint8_t          ime;
+  uint8_t          lcd_dirty;     /* VRAM or OAM changed since the last line. */
+  uint8_t          lcd_pending;   /* Captured lines wait for rendering. */
+  uint8_t          bus_locked;    /* OAM DMA holds the bus. */
+  int              stall;         /* CPU cycles held by DMA or a speed switch. */
+  int              timer_counter;
+  int              div_counter;
+  int              scanline;
+  sched_t          sched;
+  const uint8_t   *pages[16];
+  uint8_t         *wpages[16];
+  
+  /* Every line or frame. */
+  gb_render_mode_t render_mode;
+  gb_render_mode_t render_next;   /* Takes over at the next VBlank. */
+  gb_renderer_t    lcdc_renderer; /* For the current value of LCDC. */
+  uint32_t         lcd_epoch;
+  uint8_t          window_line;
+  int              log_first, log_end;
+  int              frame_drawn, frame_changed;
+  gb_line_hook_t   line_hook;
+  uint16_t        *frame;         /* Where line 0 goes, and the distance */
+  int              frame_stride;  /* from one line to the next. */
+  gb_stats_t       stats;
+  const uint8_t   *mapped[16];    /* Where each page is mapped, */
+  uint8_t         *wmapped[16];   /* for reads and for writes. */
+  joypad_t         pad;
+  serial_t         serial;
+  cgb_t            cgb;
+  
+  /* The line being rendered. */
+  const uint8_t   *render_vram;
+  const uint8_t   *render_vram1;
+  const uint8_t   *render_oam;
+  const uint16_t  *render_lut;
+  int              render_cached;
+  uint32_t         render_epoch;
+  uint8_t          line_buffer[160];
+  uint8_t          line_priority[160];
+  
+  /* Sprites covering each line, in drawing priority order. */
+  struct {
+    const uint8_t *oam;
+    uint32_t       epoch;
+    int            tall;
+    uint8_t        count[144];
+    uint8_t        lines[144][10];
+  } obj_cache;
+  
+  gb_line_t        line_log[144];
+  gb_line_t        drawn[144];
+  gb_line_t        frame_log[144];
+  int              have_frame_log;
+  
+#ifdef ORCHARD_THREADS
+  pthread_t        worker;
+  pthread_mutex_t  worker_lock;
+  pthread_cond_t   worker_cond;
+  int              worker_started;
+  int              worker_busy;
+  int              worker_quit;
+  struct {
+    gb_line_t      lines[144];
+    uint8_t        vram[0x2000];
+    uint8_t        vram1[0x2000];
+    uint8_t        oam[0xa0];
+    uint16_t       lut[64];
+    int            first;
+  } job;
+#endif
+  
+  /* Memory, and the cartridge. The ROM is shared, so memory starts at
+   * 0x8000; see MEM(). */
+  uint8_t          memory[0x8000];
+  uint8_t          open_bus[0x1000];
+  uint8_t          bus_sink[0x1000];
+  cart_t           cart;
+  fork_t           fork;
+  
+  bgcache_t        bgcache;
+  apu_t            apu;
+  
+  /* Left to the front end. */
+  void            *user;
+};
+
+void gb_init(gb_t *gb);
+void gb_release(gb_t *gb);
+void gb_run(gb_t *gb);
+void gb_set_clock(gb_t *gb);
+void gb_decode_row(const uint8_t *row, uint8_t *out);
+int  gb_frame_changed(gb_t *gb);
+void gb_lcd_flush(gb_t *gb);
+void gb_lcd_resume(gb_t *gb);
+void gb_lcdc_write(gb_t *gb, uint8_t value);
+void gb_set_render_mode(gb_t *gb, gb_render_mode_t mode);
+void gb_queue_render_mode(gb_t *gb, gb_render_mode_t mode);
+int  gb_render_frame(gb_t *gb);
+void gb_set_line_hook(gb_t *gb, gb_line_hook_t hook);
+void gb_set_framebuffer(gb_t *gb, uint16_t *pixels, int stride);
+void gb_stall(gb_t *gb, int cycles);
+uint32_t gb_next_hblank(gb_t *gb);
 
-extern uint8_t bank_count;
-extern uint8_t (*banks)[0x4000];
 extern int sstep;
 
 #endif
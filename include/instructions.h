@@ -177,7 +177,7 @@
 
 #define LD(OUT, IN)  OUT  = IN
 
-#define LDMEMIN(OUT, MEM) OUT = GET8(MEM)
+#define LDMEMIN(OUT, MEM) OUT = GETMEM(MEM)
 #define LDMEMOUT(MEM, IN) PUT8(MEM, IN)
 
 #define OR(IN)        \
@@ -260,7 +260,13 @@
 #define SRL(n) TODO("SRL")
 
 /* TODO: Make actually work. :P */
-#define STOP() DBG("STOP instruction encountered"); do { } while(1)
+#define STOP()                              \
+  if(!cgb_stop(gb)) {                       \
+    DBG("STOP instruction encountered");    \
+    do { } while(1);                        \
+  }                                         \
+  ++PC;                                     \
+  CLK(1)
 
 #define SUB(IN) SUB8(A, IN)
 
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_JOYPAD_H_
+#define ORCHARD_JOYPAD_H_
+
+#include <stdint.h>
+#include "z80.h"
+
+/* Buttons, as bits of a joypad state. A set bit means held. */
+#define JOYPAD_RIGHT  0x01
+#define JOYPAD_LEFT   0x02
+#define JOYPAD_UP     0x04
+#define JOYPAD_DOWN   0x08
+#define JOYPAD_A      0x10
+#define JOYPAD_B      0x20
+#define JOYPAD_SELECT 0x40
+#define JOYPAD_START  0x80
+
+/* P1 is worked out when the game reads it, from whatever the source returns
+ * at that moment, so input is as fresh as the read instead of a frame old.
+ * The default source returns the last state given to joypad_set(), which
+ * any thread may call; a front end that can read its buttons directly can
+ * install its own source instead. */
+typedef uint8_t (*joypad_source_t)(gb_t *gb);
+
+struct movie;
+
+typedef struct {
+  joypad_source_t  source;    /* NULL for the snapshot. */
+  volatile uint8_t snapshot;  /* Written and read whole, so needs no lock. */
+  uint8_t          select;    /* P1 bits 4 and 5 as last written. */
+  uint8_t          lines;     /* The input lines as last sampled. */
+  struct movie    *movie;     /* Recording or playing the buttons. */
+} joypad_t;
+
+void    joypad_reset     (gb_t *gb);
+void    joypad_set       (gb_t *gb, uint8_t buttons);
+void    joypad_set_source(gb_t *gb, joypad_source_t source);
+uint8_t joypad_read      (gb_t *gb);
+void    joypad_write     (gb_t *gb, uint8_t value);
+void    joypad_poll      (gb_t *gb);
+
+#endif
@@ -26,7 +26,11 @@
 #ifndef ORCHARD_LOADER_H_
 #define ORCHARD_LOADER_H_
 
-void load_file(const char *name);
-void load_adapter(void);
+#include <stddef.h>
+#include <stdint.h>
+#include "z80.h"
+
+void load_file   (gb_t *gb, const char *name);
+void load_adapter(gb_t *gb);
 
 #endif
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_LZ_H_
+#define ORCHARD_LZ_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A small LZ77 codec for savestates, in the spirit of LZ4: greedy matching
+ * through a hash of the next 4 bytes, and no entropy coding, so it runs at
+ * a good fraction of memcpy speed. Each sequence is a token holding the
+ * literal count and match length in 4 bits each, extended by bytes of 255
+ * where needed, the literals, then a 16-bit little-endian offset. The last
+ * sequence has literals only. Runs of a byte, like cleared memory or an XOR
+ * against an unchanged state, come out as one long overlapping match. */
+
+size_t lz_bound     (size_t size);
+size_t lz_compress  (const uint8_t *in, size_t size, uint8_t *out);
+size_t lz_decompress(const uint8_t *in, size_t size, uint8_t *out, size_t max);
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_MOVIE_H_
+#define ORCHARD_MOVIE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "z80.h"
+
+/* Movies are the buttons of a run, kept so the run can be played again
+ * exactly. Every time the game samples the joypad the buttons are counted,
+ * and a movie records only the samples where they changed: how many
+ * samples since the last change, as a 7-bit count, then the buttons. The
+ * machine does the same thing given the same buttons, so playing a movie
+ * back from the state it started in hands each sample what it had, even
+ * if the buttons changed mid-frame. A movie is a header, the start state
+ * as a compressed savestate, then the changes, written as they happen, so
+ * a long recording streams to a file and plays back from a mapping of it.
+ * The header gets the frame count and a hash of the state at the end when
+ * the recording stops; one cut off before that plays as far as its last
+ * change. Loading states in the middle, as rewinding and run-ahead do,
+ * breaks the count. */
+
+#define MOVIE_MAGIC   0x4d43524f  /* "ORCM" */
+#define MOVIE_VERSION 1
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t flags;
+  uint32_t rom;        /* A hash of the whole ROM, */
+  uint32_t rom_size;   /* and its size. */
+  uint32_t state;      /* Bytes of start state after the header. */
+  uint32_t frames;     /* 0 until the recording stops. */
+  uint32_t end;        /* Hash of the raw state at the end. */
+  uint32_t changes;
+} movie_header_t;
+
+typedef struct movie {
+  movie_header_t  header;
+  FILE           *out;       /* Recording to, or NULL when playing. */
+  const uint8_t  *in;        /* The changes left to play. */
+  const uint8_t  *in_end;
+  uint64_t        samples;   /* Of the buttons so far. */
+  uint64_t        at;        /* Sample of the last change, or the next. */
+  uint8_t         buttons;
+  uint8_t         next;      /* What the next change to play sets. */
+  uint8_t         pending;   /* A change is still to play. */
+  uint32_t        frames;    /* Run so far. */
+} movie_t;
+
+int     movie_record (movie_t *mv, gb_t *gb, FILE *out);
+int     movie_play   (movie_t *mv, gb_t *gb, const void *data, size_t size);
+uint8_t movie_buttons(movie_t *mv, uint8_t buttons);
+int     movie_stop   (movie_t *mv, gb_t *gb);
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_RATECTL_H_
+#define ORCHARD_RATECTL_H_
+
+#include <stdint.h>
+
+/* Dynamic rate control. Emulation is paced by the display, but sound is
+ * played by the host's audio clock, and the two never quite agree. Rather
+ * than absorbing the drift with a deep buffer, the controller looks at how
+ * full the host's audio buffer is once a frame and returns a small change
+ * to the resampling ratio, in parts per million, that steers the fill back
+ * to a target a couple of frames deep. Changes of a fraction of a percent
+ * can't be heard as pitch. */
+
+typedef struct {
+  uint32_t updates;
+  int      fill;           /* Frames buffered at the last update. */
+  int      fill_min;
+  int      fill_max;
+  uint64_t fill_total;     /* Over all updates, for the average. */
+  uint32_t latency_us;     /* What the last fill means in playback time. */
+  uint32_t latency_max_us;
+  int32_t  adjust_ppm;     /* The last change returned. */
+} ratectl_stats_t;
+
+void    ratectl_init  (int rate, int target, int max_ppm);
+int32_t ratectl_update(int fill);
+
+extern ratectl_stats_t ratectl_stats;
+
+#endif
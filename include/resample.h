@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_RESAMPLE_H_
+#define ORCHARD_RESAMPLE_H_
+
+#include <stdint.h>
+
+/* Resamplers bring the APU's 16-bit stereo output to the host's rate with a
+ * polyphase FIR filter. Each output sample is a dot product of the filter
+ * phase nearest its position with the input around it; the ratio is kept
+ * to 32 fractional bits, so it can be nudged while running. Both channels
+ * are stored apart so the dot products run over contiguous samples. */
+
+#define RESAMPLE_PHASES    512
+#define RESAMPLE_MAX_TAPS  64
+#define RESAMPLE_BUFFER    4096
+
+typedef struct {
+  int      taps;                           /* A multiple of 8. */
+  uint64_t pos;                            /* Next output, 32.32 in input samples. */
+  uint64_t step;                           /* Input samples per output sample. */
+  int      fill;                           /* Input samples buffered. */
+  int16_t  coef[RESAMPLE_PHASES][RESAMPLE_MAX_TAPS];
+  int16_t  in[2][RESAMPLE_BUFFER];
+} resampler_t;
+
+int    resampler_init     (resampler_t *r, int taps, int in_rate, int out_rate);
+void   resampler_set_ratio(resampler_t *r, double ratio);
+double resampler_ratio    (const resampler_t *r);
+int    resampler_write    (resampler_t *r, const int16_t *in, int frames);
+int    resampler_read     (resampler_t *r, int16_t *out, int frames);
+
+/* Dot product of n 16-bit samples with Q15 coefficients, n a multiple of
+ * 8. Exposed for benchmarking. */
+int32_t resample_dot        (const int16_t *x, const int16_t *k, int n);
+int32_t resample_dot_generic(const int16_t *x, const int16_t *k, int n);
+
+#endif
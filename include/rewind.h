@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_REWIND_H_
+#define ORCHARD_REWIND_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "z80.h"
+
+/* Rewinding keeps a raw savestate of every frame in a ring of bounded size.
+ * Most frames are stored as the XOR of their state with the one before,
+ * run-length coded a word at a time, which comes out at a few hundred bytes
+ * when a frame changed little and is built in one pass over the state.
+ * Every interval frames, and whenever the state's size changes, a full
+ * keyframe is stored instead, compressed with lz.h. XOR works both ways, so
+ * stepping back from a delta undoes it in place; stepping back past a
+ * keyframe rebuilds the frame before it from the previous keyframe. When
+ * the ring is full the oldest keyframe goes, with the deltas after it. */
+
+typedef struct {
+  size_t   offset;   /* Into the ring. */
+  size_t   size;
+  int      key;
+} rewind_entry_t;
+
+typedef struct {
+  uint8_t        *ring;
+  size_t          ring_size;
+  size_t          used;         /* Bytes held by entries. */
+  rewind_entry_t *entries;      /* A ring of its own, oldest at first. */
+  int             entry_cap;
+  int             first;
+  int             count;
+  int             interval;     /* Frames between keyframes. */
+  int             since_key;    /* Deltas after the newest keyframe. */
+  
+  size_t          state_size;   /* Of the states, rounded up to words. */
+  size_t          state_len;    /* Of the newest state as saved. */
+  uint8_t        *state;        /* The newest state. */
+  uint8_t        *next;         /* The state being captured. */
+  uint8_t        *code;         /* Space to encode an entry. */
+  
+  uint32_t        keys;         /* Keyframes held. */
+  uint32_t        evicted;      /* Frames dropped to stay in size. */
+} rewind_t;
+
+int  rewind_init (rewind_t *rw, gb_t *gb, size_t bytes, int interval);
+void rewind_push (rewind_t *rw, gb_t *gb);
+int  rewind_pop  (rewind_t *rw, gb_t *gb);
+void rewind_clear(rewind_t *rw);
+void rewind_free (rewind_t *rw);
+
+#endif
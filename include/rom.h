@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_ROM_H_
+#define ORCHARD_ROM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* ROM images are loaded once and shared, read-only, by every instance that
+ * runs them: the page tables point straight into the image. Images are
+ * found again by name while anyone holds a reference, and the last
+ * reference frees them. The data is padded with 0xff to a whole number of
+ * 16 KB banks, at least two. */
+typedef struct rom {
+  char          *name;
+  const uint8_t *data;
+  size_t         size;    /* Padded to whole banks. */
+  int            banks;   /* 16 KB banks. */
+  int            refs;
+  struct rom    *next;
+} rom_t;
+
+rom_t *rom_open  (const char *name);
+rom_t *rom_create(const char *name, const uint8_t *data, size_t size);
+rom_t *rom_ref   (rom_t *rom);
+void   rom_unref (rom_t *rom);
+void   rom_stats (int *images, size_t *bytes);
+
+#endif
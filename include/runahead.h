@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_RUNAHEAD_H_
+#define ORCHARD_RUNAHEAD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "z80.h"
+
+/* Run-ahead hides the frames of lag a game builds in between reading the
+ * buttons and showing what they did. Each displayed frame runs the real
+ * frame without pixels, saves its state, runs frames more with the same
+ * buttons and shows the last of them, then loads the saved state back, so
+ * the game is always where the real frame left it. Only the shown frame is
+ * rendered and only the real one is heard: synthesis is held while the
+ * speculative frames run, and so is the serial hook. With frames at 0 it
+ * is plain gb_run(). */
+
+typedef struct {
+  int      frames;    /* Run ahead of the real frame. */
+  uint8_t *state;     /* The real frame's state, raw. */
+  size_t   size;
+} runahead_t;
+
+int  runahead_init(runahead_t *ra, gb_t *gb, int frames);
+void runahead_run (runahead_t *ra, gb_t *gb);
+void runahead_free(runahead_t *ra);
+
+#endif
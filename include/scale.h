@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_SCALE_H_
+#define ORCHARD_SCALE_H_
+
+#include <stdint.h>
+
+/* Scalers turn the emulator's 160x144 RGB15 output into 32-bit RGBA (red in
+ * the lowest byte) at host resolution. Lines are fed one at a time as they
+ * are rendered, so scaling overlaps emulation. scaler_init() fills the
+ * whole target: sizes exactly 2, 3 or 4 times 160x144 use pixel
+ * replication, anything else is bilinear. scaler_init_integer() replicates
+ * by the largest of those factors that fits instead, centred, with a black
+ * border around it, the way the DS shows the picture in the middle of its
+ * screen. */
+
+#define SCALE_MAX_WIDTH  2048
+#define SCALE_MAX_HEIGHT 2048
+
+typedef struct {
+  uint32_t *dst;
+  int       pitch;   /* In pixels. */
+  int       width;
+  int       height;
+  int       factor;  /* 0 for bilinear. */
+  
+  /* Bilinear state: the converted source frame, and for each output row and
+   * column, the first source pixel and the weight of the second (0-256). */
+  uint32_t  frame[144][161];
+  uint8_t   row_y0[SCALE_MAX_HEIGHT];
+  uint16_t  row_fy[SCALE_MAX_HEIGHT];
+  uint16_t  col_x0[SCALE_MAX_WIDTH];
+  uint16_t  col_fx[SCALE_MAX_WIDTH];
+  int       first_row[145];
+  uint8_t   pending[144];
+} scaler_t;
+
+int  scaler_init(scaler_t *s, uint32_t *dst, int pitch, int width, int height);
+int  scaler_init_integer(scaler_t *s, uint32_t *dst, int pitch, int width, int height);
+void scaler_line (scaler_t *s, int ly, const uint16_t *src);
+void scaler_flush(scaler_t *s);
+
+/* Individual kernels, exposed for benchmarking. */
+void scale_convert        (const uint16_t *src, uint32_t *dst, int n);
+void scale_convert_generic(const uint16_t *src, uint32_t *dst, int n);
+void scale_repeat         (const uint32_t *src, uint32_t *dst, int n, int factor);
+void scale_repeat_generic (const uint32_t *src, uint32_t *dst, int n, int factor);
+void scale_blend          (const uint32_t *a, const uint32_t *b, uint32_t *dst, int n, int fy);
+void scale_blend_generic  (const uint32_t *a, const uint32_t *b, uint32_t *dst, int n, int fy);
+void scale_stretch        (const uint32_t *src, uint32_t *dst, const uint16_t *x0,
+                           const uint16_t *fx, int n);
+void scale_stretch_generic(const uint32_t *src, uint32_t *dst, const uint16_t *x0,
+                           const uint16_t *fx, int n);
+
+#endif
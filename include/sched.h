@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_SCHED_H_
+#define ORCHARD_SCHED_H_
+
+#include <stdint.h>
+#include "z80.h"
+
+/* Events due at a known time, measured in dots: the 4194304 Hz clock of the
+ * LCD, which keeps its rate in double-speed mode. Time only moves through
+ * sched_advance(), which counts down to the next event so running between
+ * events costs a subtraction and a branch. Times wrap around, so they are
+ * only ever compared through their difference. Each event always runs the
+ * same handler, so the schedule is plain data that a savestate can copy. */
+
+typedef enum {
+  SCHED_HDMA,   /* Next HBlank HDMA block. */
+  SCHED_DMA,    /* End of OAM DMA. */
+  SCHED_APU,    /* Next frame sequencer step. */
+  SCHED_SERIAL, /* End of a serial transfer. */
+  SCHED_EVENTS
+} sched_event_t;
+
+/* left, the dots until the next event is due, started out as span at time
+ * base. */
+typedef struct {
+  int32_t  left;
+  int32_t  span;
+  uint32_t base;
+  uint32_t when[SCHED_EVENTS];
+  uint32_t pending;  /* A bit per scheduled event. */
+} sched_t;
+
+void     sched_reset (gb_t *gb);
+void     sched_at    (gb_t *gb, sched_event_t event, uint32_t delay);
+void     sched_repeat(gb_t *gb, sched_event_t event, uint32_t period);
+void     sched_cancel(gb_t *gb, sched_event_t event);
+void     sched_run   (gb_t *gb);
+uint32_t sched_time  (gb_t *gb);
+
+/* Moves time forward, running whatever fell due. A macro, since gb_t is
+ * only complete once gb.h is included. */
+#define sched_advance(gb, dots)                 \
+  do {                                          \
+    if(((gb)->sched.left -= (dots)) <= 0)       \
+      sched_run(gb);                            \
+  } while(0)
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_SERIAL_H_
+#define ORCHARD_SERIAL_H_
+
+#include <stdint.h>
+#include "z80.h"
+
+/* The serial port, with nothing plugged in. A transfer the game clocks
+ * itself shifts SB out for 4096 cycles, then reads back 0xff and raises the
+ * serial interrupt; transfers waiting on an outside clock never finish. Each
+ * byte sent goes to the hook, which is how test ROMs report results. */
+typedef void (*serial_hook_t)(gb_t *gb, uint8_t byte);
+
+typedef struct {
+  serial_hook_t hook;
+  uint8_t       out;      /* The byte being shifted out. */
+} serial_t;
+
+void serial_reset   (gb_t *gb);
+void serial_set_hook(gb_t *gb, serial_hook_t hook);
+void serial_write   (gb_t *gb, uint16_t addr, uint8_t value);
+void serial_done    (gb_t *gb);
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_SNAP_H_
+#define ORCHARD_SNAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A store for many raw savestates that mostly hold the same memory. A state
+ * is cut into pages: everything before offset as one, then 4 KB at a time,
+ * which for offset = state_memory() lines pages up with the memory regions
+ * of the layout. Each page is stored once, found by its hash and counted by
+ * reference, and a snapshot is the list of its pages. Identical snapshots
+ * are stored once too, so inserting a state that is already held only
+ * takes a reference, and snap_find() tells whether it is. Handles stay the
+ * same for as long as the snapshot is held. */
+
+#define SNAP_PAGE 0x1000
+#define SNAP_NONE 0xffffffffu
+
+/* What pages and snapshots have in common. */
+typedef struct {
+  uint64_t  hash;
+  uint32_t  refs;        /* 0 while on the free list. */
+  uint32_t  next;        /* In its hash chain, or the free list. */
+} snap_entry_t;
+
+typedef struct {
+  snap_entry_t e;
+  uint32_t     size;
+  uint8_t     *data;
+} snap_page_t;
+
+typedef struct {
+  snap_entry_t e;        /* Hashed over its page numbers. */
+  uint32_t     count;
+  uint32_t    *pages;
+  size_t       size;     /* Of the state. */
+} snap_t;
+
+/* Pages and snapshots each live in an array, reused through a free list,
+ * with chains of hash buckets over it. */
+typedef struct {
+  void     *items;
+  uint32_t  used;        /* Entries handed out, free or not. */
+  uint32_t  cap;
+  uint32_t  free;
+  uint32_t *buckets;
+  uint32_t  mask;        /* Buckets - 1. */
+  uint32_t  live;
+} snap_table_t;
+
+typedef struct {
+  size_t        offset;
+  snap_table_t  pages;
+  snap_table_t  snaps;
+  uint32_t     *scratch;     /* Page numbers of the state at hand. */
+  uint32_t      scratch_cap;
+  
+  /* Statistics. */
+  uint64_t      held;        /* Bytes of the snapshots held, in full. */
+  uint64_t      stored;      /* Bytes of pages stored. */
+} snap_store_t;
+
+int      snap_init   (snap_store_t *st, size_t offset);
+uint32_t snap_insert (snap_store_t *st, const void *state, size_t size);
+uint32_t snap_find   (snap_store_t *st, const void *state, size_t size);
+size_t   snap_restore(snap_store_t *st, uint32_t snap, void *buf, size_t size);
+void     snap_release(snap_store_t *st, uint32_t snap);
+void     snap_free   (snap_store_t *st);
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ORCHARD_STATE_H_
+#define ORCHARD_STATE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "z80.h"
+
+/* Savestates are one blob with a fixed layout: a header, then every field
+ * that decides what the machine does next, in an order and width set here
+ * rather than by gb_t, then the large memories and cartridge RAM. Saving is
+ * a walk over the fields plus a few memcpys, so it is cheap enough to do
+ * every frame. What belongs to the front end stays out: the framebuffer,
+ * hooks, statistics, the render mode and the buttons held now. Multi-byte
+ * fields are stored as the host has them; both the DS and x86 are
+ * little-endian.
+ *
+ * Everything after the header can be compressed with lz.h. A state only
+ * loads into an instance that was started with gb_init() on the same
+ * game. */
+
+#define STATE_MAGIC   0x5343524f  /* "ORCS" */
+#define STATE_VERSION 1
+
+/* Flags for state_save(). */
+#define STATE_COMPRESS 1
+
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t flags;
+  uint32_t size;       /* Of the state uncompressed, header included. */
+  uint32_t stored;     /* Bytes after the header as stored. */
+  uint32_t rom;        /* Checksums from the cartridge header. */
+  uint32_t cart_ram;   /* Bytes of cartridge RAM at the end. */
+} state_header_t;
+
+size_t state_size(gb_t *gb);
+size_t state_memory(gb_t *gb);
+size_t state_save(gb_t *gb, void *buf, size_t size, int flags);
+int    state_load(gb_t *gb, const void *buf, size_t size);
+int    state_fork(gb_t *child, gb_t *parent);
+
+#endif
@@ -28,6 +28,11 @@
 
 #include <stdint.h>
 
+/* Everything one emulated Game Boy owns; see gb.h. The core works on the
+ * instance given to it as gb, which the macros below refer to, so several
+ * can run side by side. */
+typedef struct gb gb_t;
+
 /* Macros to test various values of the flag register. */
 #define FLAG(FLAG)  (F & (FLAG))
 #define ZERO        (1 << 7)
@@ -44,33 +49,40 @@
 *  the values of the indices will have to be flipped for
 *  a big-endian architecture. I couldn't find a portable way
 *  around this, sadly enough. ): */
-#define A _AF[1]
-#define B _BC[1]
-#define C _BC[0]
-#define D _DE[1]
-#define E _DE[0]
-#define F _AF[0]
-#define H _HL[1]
-#define L _HL[0]
+#define A gb->af[1]
+#define B gb->bc[1]
+#define C gb->bc[0]
+#define D gb->de[1]
+#define E gb->de[0]
+#define F gb->af[0]
+#define H gb->hl[1]
+#define L gb->hl[0]
 
 /* Macros representing the 16-bit registers. */
-#define AF (*((uint16_t*)_AF))
-#define BC (*((uint16_t*)_BC))
-#define DE (*((uint16_t*)_DE))
-#define HL (*((uint16_t*)_HL))
-#define SP _SP
-#define PC _PC
+#define AF (*((uint16_t*)gb->af))
+#define BC (*((uint16_t*)gb->bc))
+#define DE (*((uint16_t*)gb->de))
+#define HL (*((uint16_t*)gb->hl))
+#define SP gb->sp
+#define PC gb->pc
+#define IME gb->ime
 
-extern uint8_t  _AF[2], _BC[2], _DE[2], _HL[2];
-extern uint16_t _SP,    _PC;
-extern uint8_t  IME;
-extern uint8_t z80_memory[0xffff+1];
+/* Memory access on the current instance. */
+#define GET8(addr)         z80_get8(gb, addr)
+#define GETMEM(addr)       z80_getmem(gb, addr)
+#define PUT8(addr, value)  z80_put8(gb, addr, value)
+#define PUSHWORD(value)    z80_push(gb, value)
 
 /* Function prototypes. */
-void           z80_init   (void);
-uint8_t        z80_execute(void);
-inline uint8_t GET8       (uint16_t addr);
-inline void    PUT8       (uint16_t addr, uint8_t value);
-inline void    PUSHWORD   (uint16_t value);
+void           z80_init    (gb_t *gb);
+void           z80_remap   (gb_t *gb);
+void           z80_map     (gb_t *gb, int page, const uint8_t *read, uint8_t *write);
+void           z80_map_page(gb_t *gb, int page, uint8_t *mem);
+uint8_t        z80_execute (gb_t *gb);
+inline uint8_t z80_get8    (gb_t *gb, uint16_t addr);
+inline uint8_t z80_getmem  (gb_t *gb, uint16_t addr);
+void           z80_put8    (gb_t *gb, uint16_t addr, uint8_t value);
+void           z80_dma_end (gb_t *gb);
+inline void    z80_push    (gb_t *gb, uint16_t value);
 
 #endif
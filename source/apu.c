@@ -0,0 +1,825 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef ORCHARD_THREADS
+#include <pthread.h>
+#endif
+
+#include "apu.h"
+#include "gb.h"
+#include "sched.h"
+#include "z80.h"
+
+/* The frame sequencer runs at 512 Hz. */
+#define SEQUENCER_DOTS 8192
+
+/* Logged writes on their way to the synthesizer. A power of two. */
+#define QUEUE_SIZE APU_QUEUE_SIZE
+
+/* Samples are built in blocks; a delta spreads over BLIP_WIDTH samples and
+ * is placed at one of BLIP_PHASES positions between two of them. */
+#define APU_DOTS     (4194304 / APU_RATE)
+#define BLIP_BLOCK   APU_BLIP_BLOCK
+#define BLIP_WIDTH   APU_BLIP_WIDTH
+#define BLIP_PHASES  32
+#define KERNEL_BITS  12
+
+/* Output gain: the loudest mix, 4 channels at 15 through a master volume of
+ * 8, comes to 480 << 6. */
+#define GAIN_BITS    6
+
+/* The high-pass filter standing in for the output capacitor. */
+#define HIGHPASS_SHIFT 9
+
+/* Samples kept for apu_read(). */
+#define OUT_SIZE APU_OUT_SIZE
+
+/* Pseudo registers in the log, for state the register side works out: a
+ * channel's level (volume, or 0 when off) and channel 1's swept frequency. */
+#define EV_LEVEL 0x30
+#define EV_FREQ  0x34
+
+/* Marks the end of a frame: everything up to its time is synthesized. */
+#define EV_SYNC  0x35
+
+/* The queue and the output buffer each have one thread adding and one
+ * taking; the index a thread doesn't own is read with acquire and written
+ * with release ordering. */
+#ifdef ORCHARD_THREADS
+#define LOAD(x)     __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+#else
+#define LOAD(x)     (x)
+#define STORE(x, v) ((x) = (v))
+#endif
+
+/* What reads of each register add to the value written. */
+static const uint8_t read_mask[0x30] = {
+  0x80, 0x3f, 0x00, 0xff, 0xbf, 0xff, 0x3f, 0x00, 0xff, 0xbf,
+  0x7f, 0xff, 0x9f, 0xff, 0xbf, 0xff, 0xff, 0x00, 0x00, 0xbf,
+  0x00, 0x00, 0x70, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+  0xff, 0xff
+};
+
+#define apu   (gb->apu)
+#define synth (apu.synth)
+
+static int16_t kernel[BLIP_PHASES][BLIP_WIDTH];
+
+static const uint8_t duty_table[4] = { 0x01, 0x81, 0x87, 0x7e };
+static const uint8_t noise_divisor[8] = { 8, 16, 32, 48, 64, 80, 96, 112 };
+
+/* Band-limited steps
+ * ------------------ */
+
+#define PI 3.14159265358979323846
+
+/* Sine by range reduction and a Taylor series; only used to build the
+ * kernel, and keeps libm out of the build. */
+static double blip_sin(double x) {
+  double term, sum;
+  int    i;
+  
+  while(x >  PI) x -= 2 * PI;
+  while(x < -PI) x += 2 * PI;
+  
+  term = sum = x;
+  for(i = 1; i < 12; ++i) {
+    term *= -x * x / ((2 * i) * (2 * i + 1));
+    sum  += term;
+  }
+  
+  return sum;
+}
+
+/* Builds the windowed-sinc impulse for each phase, cut off a little below
+ * the output Nyquist frequency. Each phase sums exactly to 1 << KERNEL_BITS,
+ * so steps settle at their exact height. */
+static void blip_init(void) {
+  const double cutoff = 0.9;
+  int          p, i;
+  
+  for(p = 0; p < BLIP_PHASES; ++p) {
+    double k[BLIP_WIDTH], total = 0;
+    int    sum = 0;
+    
+    for(i = 0; i < BLIP_WIDTH; ++i) {
+      double x = i - (BLIP_WIDTH / 2 - 1) - (double)p / BLIP_PHASES;
+      double s = x ? blip_sin(PI * x * cutoff) / (PI * x) : cutoff;
+      double w = 0.42 + 0.5  * blip_sin(PI * x / (BLIP_WIDTH / 2) + PI / 2)
+                      + 0.08 * blip_sin(2 * PI * x / (BLIP_WIDTH / 2) + PI / 2);
+      
+      k[i]   = s * w;
+      total += k[i];
+    }
+    
+    for(i = 0; i < BLIP_WIDTH; ++i) {
+      double v = k[i] / total * (1 << KERNEL_BITS);
+      
+      kernel[p][i] = (int16_t)(v < 0 ? v - 0.5 : v + 0.5);
+      sum         += kernel[p][i];
+    }
+    kernel[p][BLIP_WIDTH / 2 - 1] += (1 << KERNEL_BITS) - sum;
+  }
+}
+
+/* Adds a step of dl and dr at time t, which lies within the current block. */
+static inline void blip_add(gb_t *gb, uint32_t t, int dl, int dr) {
+  uint32_t       d = t - synth.base;
+  const int16_t *k = kernel[(d % APU_DOTS) * BLIP_PHASES / APU_DOTS];
+  int32_t       *l = &synth.blip[0][d / APU_DOTS];
+  int32_t       *r = &synth.blip[1][d / APU_DOTS];
+  int            i;
+  
+  for(i = 0; i < BLIP_WIDTH; ++i) {
+    l[i] += dl * k[i];
+    r[i] += dr * k[i];
+  }
+}
+
+/* Integrates the first n samples of the block into the output, through the
+ * high-pass filter, and moves the block on. Samples that don't fit in the
+ * output are dropped. */
+static void blip_emit(gb_t *gb, int n) {
+  int room = (LOAD(apu.out_tail) - apu.out_head - 1 + OUT_SIZE) % OUT_SIZE;
+  int i, c;
+  
+  for(c = 0; c < 2; ++c) {
+    int32_t sum = synth.sum[c], dc = synth.dc[c];
+    int     head = apu.out_head;
+    
+    for(i = 0; i < n; ++i) {
+      int32_t s;
+      
+      sum += synth.blip[c][i];
+      s    = (sum - dc) >> (KERNEL_BITS - GAIN_BITS);
+      dc  += (sum - dc) >> HIGHPASS_SHIFT;
+      
+      if(s >  32767) s =  32767;
+      if(s < -32768) s = -32768;
+      if(i < room) {
+        apu.out[head][c] = s;
+        head = (head + 1) % OUT_SIZE;
+      }
+    }
+    
+    synth.sum[c] = sum;
+    synth.dc[c]  = dc;
+  }
+  if(n > room) apu.stats.dropped += n - room;
+  STORE(apu.out_head, (apu.out_head + ((n < room) ? n : room)) % OUT_SIZE);
+  
+  for(c = 0; c < 2; ++c) {
+    memmove(synth.blip[c], synth.blip[c] + n, (BLIP_BLOCK + BLIP_WIDTH + 1 - n) * sizeof(int32_t));
+    memset(synth.blip[c] + BLIP_BLOCK + BLIP_WIDTH + 1 - n, 0, n * sizeof(int32_t));
+  }
+  synth.base += n * APU_DOTS;
+}
+
+/* Synthesizer
+ * ----------- */
+
+/* Brings channel c's contribution to the mix in line with its output. */
+static inline void synth_output(gb_t *gb, int c, uint32_t t) {
+  apu_voice_t *ch  = &synth.ch[c];
+  uint8_t          pan = synth.regs[0x15];
+  int              l   = (pan & (0x10 << c)) ? ch->amp * synth.vol_l : 0;
+  int              r   = (pan & (0x01 << c)) ? ch->amp * synth.vol_r : 0;
+  
+  if((l != ch->out_l) || (r != ch->out_r)) {
+    blip_add(gb, t, l - ch->out_l, r - ch->out_r);
+    ch->out_l = l;
+    ch->out_r = r;
+  }
+}
+
+/* Works out channel c's output from its level and waveform position. */
+static void synth_amp(gb_t *gb, int c) {
+  apu_voice_t *ch = &synth.ch[c];
+  
+  if(c < 2)
+    ch->amp = ((duty_table[synth.regs[c * 5 + 1] >> 6] >> ch->pos) & 1) ? ch->level : 0;
+  else if(c == 2)
+    ch->amp = ch->level ? synth.wave[ch->pos] >> synth.wave_shift : 0;
+  else
+    ch->amp = (~synth.lfsr & 1) ? ch->level : 0;
+}
+
+/* Steps channel c's waveform up to time end. */
+static void synth_channel(gb_t *gb, int c, uint32_t end) {
+  apu_voice_t *ch = &synth.ch[c];
+  
+  if(!ch->period)
+    return;
+  
+  /* A silent channel only needs its position moved on; the noise LFSR is
+   * left where it is. */
+  if(!ch->level) {
+    if((int32_t)(end - ch->next) > 0) {
+      uint32_t steps = (end - ch->next + ch->period - 1) / ch->period;
+      
+      if(c < 3) ch->pos = (ch->pos + steps) & ((c < 2) ? 7 : 31);
+      ch->next += steps * ch->period;
+    }
+    return;
+  }
+  
+  while((int32_t)(end - ch->next) > 0) {
+    if(c < 2) {
+      ch->pos = (ch->pos + 1) & 7;
+    }
+    else if(c == 2) {
+      ch->pos = (ch->pos + 1) & 31;
+    }
+    else {
+      uint16_t bit = (synth.lfsr ^ (synth.lfsr >> 1)) & 1;
+      
+      synth.lfsr = (synth.lfsr >> 1) | (bit << 14);
+      if(synth.regs[0x12] & 0x08)
+        synth.lfsr = (synth.lfsr & ~0x40) | (bit << 6);
+    }
+    
+    synth_amp(gb, c);
+    synth_output(gb, c, ch->next);
+    ch->next += ch->period;
+  }
+}
+
+/* Recomputes channel c's step length from its registers. Frequencies too
+ * high to hear hold the channel still. */
+static void synth_period(gb_t *gb, int c, uint32_t t) {
+  apu_voice_t *ch     = &synth.ch[c];
+  uint32_t         period = 0;
+  
+  if(c < 3) {
+    int freq = synth.regs[c * 5 + 3] | ((synth.regs[c * 5 + 4] & 7) << 8);
+    
+    period = (2048 - freq) * ((c < 2) ? 4 : 2);
+    if(period * ((c < 2) ? 8 : 32) < 2 * APU_DOTS) period = 0;
+  }
+  else if((synth.regs[0x12] >> 4) < 14) {
+    period = noise_divisor[synth.regs[0x12] & 7] << (synth.regs[0x12] >> 4);
+  }
+  
+  if(period && !ch->period) ch->next = t + period;
+  ch->period = period;
+}
+
+/* Runs every channel up to time t, emitting whole blocks on the way. */
+static void synth_run(gb_t *gb, uint32_t t) {
+  int c;
+  
+  while((int32_t)(t - (synth.base + BLIP_BLOCK * APU_DOTS)) > 0) {
+    uint32_t end = synth.base + BLIP_BLOCK * APU_DOTS;
+    
+    for(c = 0; c < 4; ++c) synth_channel(gb, c, end);
+    blip_emit(gb, BLIP_BLOCK);
+  }
+  
+  for(c = 0; c < 4; ++c) synth_channel(gb, c, t);
+}
+
+/* Applies one logged event at its time. */
+static void synth_event(gb_t *gb, const apu_event_t *ev) {
+  uint32_t t = ev->time;
+  int      r = ev->reg;
+  int      c;
+  
+  synth_run(gb, t);
+  
+  if(r == EV_SYNC) {
+    blip_emit(gb, (t - synth.base) / APU_DOTS);
+    return;
+  }
+  
+  if(r == EV_FREQ) {
+    synth.regs[0x03] = ev->value & 0xff;
+    synth.regs[0x04] = (synth.regs[0x04] & ~7) | (ev->value >> 8);
+    synth_period(gb, 0, t);
+    return;
+  }
+  
+  if(r >= EV_LEVEL) {
+    c                  = r - EV_LEVEL;
+    synth.ch[c].level  = ev->value;
+    synth_amp(gb, c);
+    synth_output(gb, c, t);
+    return;
+  }
+  
+  synth.regs[r] = ev->value;
+  
+  /* Wave RAM holds two samples per byte, high nibble first. */
+  if(r >= 0x20) {
+    synth.wave[(r - 0x20) * 2]     = ev->value >> 4;
+    synth.wave[(r - 0x20) * 2 + 1] = ev->value & 15;
+    return;
+  }
+  
+  /* Master volume and panning change every channel's contribution. */
+  if((r == 0x14) || (r == 0x15)) {
+    synth.vol_l = ((synth.regs[0x14] >> 4) & 7) + 1;
+    synth.vol_r = (synth.regs[0x14] & 7) + 1;
+    for(c = 0; c < 4; ++c) synth_output(gb, c, t);
+    return;
+  }
+  
+  if(r >= 0x14)
+    return;
+  
+  c = r / 5;
+  
+  if(r == 0x0c) {
+    static const uint8_t shifts[4] = { 4, 0, 1, 2 };
+    synth.wave_shift = shifts[(ev->value >> 5) & 3];
+  }
+  
+  /* A trigger restarts the waveform. */
+  if(((r % 5) == 4) && (ev->value & 0x80)) {
+    if(c == 2) synth.ch[c].pos = 0;
+    if(c == 3) synth.lfsr      = 0x7fff;
+    synth.ch[c].period = 0;
+  }
+  
+  synth_period(gb, c, t);
+  synth_amp(gb, c);
+  synth_output(gb, c, t);
+}
+
+/* Applies every queued write, in order. */
+static void synth_drain(gb_t *gb) {
+  uint32_t tail = apu.queue_tail;
+  uint32_t head = LOAD(apu.queue_head);
+  
+  while(tail != head) {
+    synth_event(gb, &apu.queue[tail % QUEUE_SIZE]);
+    STORE(apu.queue_tail, ++tail);
+    if(tail == head) head = LOAD(apu.queue_head);
+  }
+}
+
+/* Starts the synthesizer over from the register side's current state. */
+static void synth_reset(gb_t *gb, uint32_t t) {
+  int r, c;
+  
+  memset(&synth, 0, sizeof synth);
+  synth.base = t;
+  synth.lfsr = 0x7fff;
+  
+  for(r = 0; r < 0x30; ++r) {
+    apu_event_t ev = { t, apu.regs[r], r };
+    
+    /* Replaying a trigger would restart the channel; wave RAM and the
+     * unused registers keep every bit. */
+    if((r < 0x14) && ((r % 5) == 4)) ev.value &= 0x7f;
+    synth_event(gb, &ev);
+  }
+  
+  for(c = 0; c < 4; ++c) {
+    apu_event_t ev = { t, apu.ch[c].level, EV_LEVEL + c };
+    synth_event(gb, &ev);
+  }
+}
+
+/* Register side
+ * ------------- */
+
+#ifdef ORCHARD_THREADS
+static void *apu_worker(void *arg) {
+  gb_t *gb = arg;
+  
+  pthread_mutex_lock(&apu.worker_lock);
+  
+  for(;;) {
+    for(;;) {
+      __atomic_store_n(&apu.worker_asleep, 1, __ATOMIC_SEQ_CST);
+      if(__atomic_load_n(&apu.queue_head, __ATOMIC_SEQ_CST) != apu.queue_tail)
+        break;
+      apu.worker_busy = 0;
+      pthread_cond_broadcast(&apu.worker_idle);
+      if(apu.worker_quit) {
+        pthread_mutex_unlock(&apu.worker_lock);
+        return NULL;
+      }
+      pthread_cond_wait(&apu.worker_wake, &apu.worker_lock);
+    }
+    __atomic_store_n(&apu.worker_asleep, 0, __ATOMIC_SEQ_CST);
+    apu.worker_busy   = 1;
+    pthread_mutex_unlock(&apu.worker_lock);
+    
+    synth_drain(gb);
+    
+    pthread_mutex_lock(&apu.worker_lock);
+    pthread_cond_broadcast(&apu.worker_idle);
+  }
+}
+
+/* Wakes the worker to synthesize what has been queued. */
+static void apu_worker_wake(gb_t *gb) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if(!__atomic_load_n(&apu.worker_asleep, __ATOMIC_SEQ_CST))
+    return;
+  
+  pthread_mutex_lock(&apu.worker_lock);
+  pthread_cond_signal(&apu.worker_wake);
+  pthread_mutex_unlock(&apu.worker_lock);
+}
+#endif
+
+/* Makes room in a full queue: by waiting for the worker, or by synthesizing
+ * the queue here. */
+static void apu_queue_full(gb_t *gb) {
+#ifdef ORCHARD_THREADS
+  if(apu.worker_on) {
+    ++apu.stats.queue_stalls;
+    pthread_mutex_lock(&apu.worker_lock);
+    pthread_cond_signal(&apu.worker_wake);
+    while(apu.queue_head - LOAD(apu.queue_tail) == QUEUE_SIZE)
+      pthread_cond_wait(&apu.worker_idle, &apu.worker_lock);
+    pthread_mutex_unlock(&apu.worker_lock);
+    return;
+  }
+#endif
+  
+  synth_drain(gb);
+}
+
+static void apu_log(gb_t *gb, int reg, uint16_t value) {
+  apu_event_t *ev;
+  uint32_t     depth;
+  
+  if(!apu.synth_on)
+    return;
+  
+  depth = apu.queue_head - LOAD(apu.queue_tail);
+  if(depth == QUEUE_SIZE) {
+    apu_queue_full(gb);
+    depth = apu.queue_head - LOAD(apu.queue_tail);
+  }
+  if(depth >= apu.stats.queue_peak) apu.stats.queue_peak = depth + 1;
+  
+  ev        = &apu.queue[apu.queue_head % QUEUE_SIZE];
+  ev->time  = sched_time(gb);
+  ev->reg   = reg;
+  ev->value = value;
+  STORE(apu.queue_head, apu.queue_head + 1);
+}
+
+/* Returns whether channel c's DAC is on. */
+static int apu_dac(gb_t *gb, int c) {
+  if(c == 2) return apu.regs[0x0a] & 0x80;
+  return apu.regs[c * 5 + 2] & 0xf8;
+}
+
+/* Logs level changes and updates what NR52 reads. */
+static void apu_levels(gb_t *gb) {
+  uint8_t status = 0x70 | (apu.power << 7);
+  int     c;
+  
+  for(c = 0; c < 4; ++c) {
+    apu_channel_t *ch    = &apu.ch[c];
+    uint8_t        level = 0;
+    
+    if(ch->enabled) {
+      status |= 1 << c;
+      level   = (c == 2) ? 1 : ch->volume;
+    }
+    
+    if(level != ch->level) {
+      ch->level = level;
+      apu_log(gb, EV_LEVEL + c, level);
+    }
+  }
+  
+  MEM(0xff26) = status;
+}
+
+/* Channel 1's next swept frequency; going past 2047 turns the channel off. */
+static int apu_sweep(gb_t *gb) {
+  int delta = apu.shadow >> (apu.regs[0x00] & 7);
+  int freq  = (apu.regs[0x00] & 0x08) ? apu.shadow - delta : apu.shadow + delta;
+  
+  if(freq > 2047) apu.ch[0].enabled = 0;
+  return freq;
+}
+
+static void apu_trigger(gb_t *gb, int c) {
+  apu_channel_t *ch = &apu.ch[c];
+  
+  ch->enabled   = apu_dac(gb, c) ? 1 : 0;
+  ch->volume    = apu.regs[c * 5 + 2] >> 4;
+  ch->env_timer = apu.regs[c * 5 + 2] & 7;
+  if(!ch->length) ch->length = (c == 2) ? 256 : 64;
+  
+  if(c == 0) {
+    uint8_t period = (apu.regs[0x00] >> 4) & 7;
+    
+    apu.shadow      = apu.regs[0x03] | ((apu.regs[0x04] & 7) << 8);
+    apu.sweep_timer = period ? period : 8;
+    apu.sweep_on    = period || (apu.regs[0x00] & 7);
+    if(apu.regs[0x00] & 7) apu_sweep(gb);
+  }
+}
+
+/* Turns the APU off, clearing every register but wave RAM. */
+static void apu_power_off(gb_t *gb) {
+  int r;
+  
+  for(r = 0; r < 0x16; ++r) {
+    apu.regs[r]          = 0;
+    MEM(0xff10+r) = read_mask[r];
+    apu_log(gb, r, 0);
+  }
+  memset(apu.ch, 0, sizeof apu.ch);
+  apu.power = 0;
+}
+
+/* Handles a write to 0xff10-0xff3f. */
+void apu_write(gb_t *gb, uint16_t addr, uint8_t value) {
+  int r = addr - 0xff10;
+  int c = r / 5;
+  
+  /* While off, only NR52 and wave RAM take writes. */
+  if(!apu.power && (r < 0x16))
+    return;
+  
+  if(r == 0x16) {
+    if(!(value & 0x80) && apu.power) apu_power_off(gb);
+    apu.power = value >> 7;
+    apu_levels(gb);
+    return;
+  }
+  
+  apu.regs[r]      = value;
+  MEM(addr) = value | ((r < 0x20) ? read_mask[r] : 0);
+  apu_log(gb, r, value);
+  
+  if(r >= 0x14)
+    return;
+  
+  switch(r % 5) {
+    case 0:
+      if(c == 2 && !apu_dac(gb, c)) apu.ch[c].enabled = 0;
+      break;
+    
+    case 1:
+      apu.ch[c].length = (c == 2) ? 256 - value : 64 - (value & 63);
+      break;
+    
+    case 2:
+      if(c != 2 && !apu_dac(gb, c)) apu.ch[c].enabled = 0;
+      break;
+    
+    case 4:
+      if(value & 0x80) apu_trigger(gb, c);
+      break;
+  }
+  
+  apu_levels(gb);
+}
+
+/* One step of the frame sequencer: lengths on even steps, the sweep on
+ * steps 2 and 6, envelopes on step 7. */
+void apu_step(gb_t *gb) {
+  int c;
+  
+  sched_repeat(gb, SCHED_APU, SEQUENCER_DOTS);
+  
+  if(!apu.power)
+    return;
+  
+  if(!(apu.step & 1)) {
+    for(c = 0; c < 4; ++c) {
+      apu_channel_t *ch = &apu.ch[c];
+      
+      if((apu.regs[c * 5 + 4] & 0x40) && ch->length && !--ch->length)
+        ch->enabled = 0;
+    }
+  }
+  
+  if(((apu.step & 3) == 2) && apu.sweep_on && !--apu.sweep_timer) {
+    uint8_t period = (apu.regs[0x00] >> 4) & 7;
+    
+    apu.sweep_timer = period ? period : 8;
+    if(period && apu.ch[0].enabled) {
+      int freq = apu_sweep(gb);
+      
+      if((freq <= 2047) && (apu.regs[0x00] & 7)) {
+        apu.shadow       = freq;
+        apu.regs[0x03]   = freq & 0xff;
+        apu.regs[0x04]   = (apu.regs[0x04] & ~7) | (freq >> 8);
+        apu_log(gb, EV_FREQ, freq);
+        apu_sweep(gb);
+      }
+    }
+  }
+  
+  if(apu.step == 7) {
+    for(c = 0; c < 4; ++c) {
+      apu_channel_t *ch  = &apu.ch[c];
+      uint8_t        env = apu.regs[c * 5 + 2];
+      
+      if((c == 2) || !(env & 7) || --ch->env_timer)
+        continue;
+      
+      ch->env_timer = env & 7;
+      if((env & 0x08) && (ch->volume < 15)) ++ch->volume;
+      if(!(env & 0x08) && ch->volume)       --ch->volume;
+    }
+  }
+  
+  apu.step = (apu.step + 1) & 7;
+  apu_levels(gb);
+}
+
+/* Takes over the sound registers gb_init() left in memory. The boot
+ * sound has faded by then: channel 1 is still on, at volume 0. */
+void apu_reset(gb_t *gb) {
+  int r;
+  
+#ifdef ORCHARD_THREADS
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  
+  pthread_once(&once, blip_init);
+#else
+  if(!kernel[0][BLIP_WIDTH / 2 - 1])
+    blip_init();
+#endif
+  
+  apu_sync(gb);
+  memset(&apu, 0, offsetof(apu_t, queue_head));
+  for(r = 0; r < 0x30; ++r) {
+    apu.regs[r] = MEM(0xff10 + r);
+    if(r < 0x20) MEM(0xff10 + r) |= read_mask[r];
+  }
+  
+  apu.power         = apu.regs[0x16] >> 7;
+  apu.ch[0].enabled = apu.regs[0x16] & 1;
+  apu.synth_on      = 1;
+  apu_levels(gb);
+  
+  apu.queue_head = apu.queue_tail = 0;
+  apu.out_head   = apu.out_tail   = 0;
+  synth_reset(gb, sched_time(gb));
+  sched_at(gb, SCHED_APU, SEQUENCER_DOTS);
+}
+
+/* Picks up after a savestate replaced the register side. What was still
+ * queued belongs to the old state, so the synthesizer starts over from the
+ * new registers, as if it had just been turned on. */
+void apu_resume(gb_t *gb) {
+  apu_sync(gb);
+  STORE(apu.queue_tail, apu.queue_head);
+  if(apu.synth_on) synth_reset(gb, sched_time(gb));
+}
+
+/* Turns synthesis on or off. The registers keep working either way; turning
+ * synthesis back on picks up from their current state. */
+void apu_enable(gb_t *gb, int enable) {
+  enable = !!enable;
+  if(enable == apu.synth_on)
+    return;
+  
+  apu_sync(gb);
+  apu.synth_on = enable;
+  if(enable) synth_reset(gb, sched_time(gb));
+}
+
+/* Holds synthesis while frames run that a savestate will take back:
+ * nothing is logged or synthesized meanwhile. Unlike apu_enable(), letting
+ * go doesn't start over, so the state from just before holding must have
+ * been loaded again by then, or the synthesizer picks up from registers it
+ * never saw. */
+void apu_hold(gb_t *gb, int hold) {
+  if(hold) {
+    apu_sync(gb);
+    apu.held     = apu.synth_on;
+    apu.synth_on = 0;
+  }
+  else {
+    apu.synth_on = apu.held;
+    apu.held     = 0;
+  }
+}
+
+/* Moves synthesis to a worker thread or back, ending the thread. Without
+ * ORCHARD_THREADS it always runs in apu_frame(). */
+void apu_set_threaded(gb_t *gb, int threaded) {
+#ifdef ORCHARD_THREADS
+  apu_sync(gb);
+  
+  if(threaded && !apu.worker_started) {
+    pthread_mutex_init(&apu.worker_lock, NULL);
+    pthread_cond_init(&apu.worker_wake, NULL);
+    pthread_cond_init(&apu.worker_idle, NULL);
+    pthread_create(&apu.worker, NULL, apu_worker, gb);
+    apu.worker_started = 1;
+  }
+  
+  if(!threaded && apu.worker_started) {
+    pthread_mutex_lock(&apu.worker_lock);
+    apu.worker_quit = 1;
+    pthread_cond_signal(&apu.worker_wake);
+    pthread_mutex_unlock(&apu.worker_lock);
+    pthread_join(apu.worker, NULL);
+    
+    pthread_mutex_destroy(&apu.worker_lock);
+    pthread_cond_destroy(&apu.worker_wake);
+    pthread_cond_destroy(&apu.worker_idle);
+    apu.worker_started = 0;
+    apu.worker_quit    = 0;
+  }
+  apu.worker_on = !!threaded;
+#endif
+}
+
+/* Synthesizes everything logged so far, up to now, and makes the finished
+ * samples available to apu_read(): here, or by handing the queue to the
+ * worker. */
+void apu_frame(gb_t *gb) {
+  if(!apu.synth_on)
+    return;
+  
+  apu_log(gb, EV_SYNC, 0);
+  apu.stats.queued = apu.queue_head - LOAD(apu.queue_tail);
+  
+#ifdef ORCHARD_THREADS
+  if(apu.worker_on) {
+    apu_worker_wake(gb);
+    return;
+  }
+#endif
+  
+  synth_drain(gb);
+}
+
+/* Waits for the worker to synthesize everything queued so far. */
+void apu_sync(gb_t *gb) {
+#ifdef ORCHARD_THREADS
+  if(!apu.worker_started)
+    return;
+  
+  pthread_mutex_lock(&apu.worker_lock);
+  pthread_cond_signal(&apu.worker_wake);
+  while(apu.worker_busy || (LOAD(apu.queue_tail) != apu.queue_head))
+    pthread_cond_wait(&apu.worker_idle, &apu.worker_lock);
+  pthread_mutex_unlock(&apu.worker_lock);
+#endif
+}
+
+/* Returns how many stereo samples apu_read() has ready. */
+int apu_pending(gb_t *gb) {
+  return (LOAD(apu.out_head) - apu.out_tail + OUT_SIZE) % OUT_SIZE;
+}
+
+/* Copies up to frames stereo samples into out, interleaved, and returns how
+ * many were copied. */
+int apu_read(gb_t *gb, int16_t *dst, int frames) {
+  int head = LOAD(apu.out_head);
+  int tail = apu.out_tail;
+  int n    = 0;
+  
+  /* At most two copies, either side of the wrap. */
+  while((n < frames) && (tail != head)) {
+    int run = ((head > tail) ? head : OUT_SIZE) - tail;
+    
+    if(run > frames - n) run = frames - n;
+    memcpy(dst + n * 2, apu.out[tail], run * sizeof apu.out[0]);
+    tail = (tail + run) % OUT_SIZE;
+    n   += run;
+  }
+  STORE(apu.out_tail, tail);
+  
+  if(n < frames) {
+    ++apu.stats.underruns;
+    apu.stats.underrun_frames += frames - n;
+  }
+  
+  return n;
+}
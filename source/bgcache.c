@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bgcache.h"
+#include "gb.h"
+#include "z80.h"
+
+/* VRAM bytes written per frame above which the cache costs more to keep up
+ * to date than rendering tiles directly. */
+#define MAX_WRITES   512
+
+/* Number of consecutive quiet frames before the cache is rebuilt. */
+#define QUIET_FRAMES 30
+
+/* A rebuild redraws every entry of both maps, which is counted as that many
+ * writes. */
+#define REBUILD_WRITES 2048
+
+#define cache (gb->bgcache)
+
+/* Maps a tile map byte to its tile number in 0x8000-0x97ff. */
+static int bgcache_tile(gb_t *gb, uint8_t index) {
+  return cache.signed_data ? 256 + (int8_t)index : index;
+}
+
+/* Redraws a single 8x8 map entry into its surface. */
+static void bgcache_draw(gb_t *gb, int map, int entry) {
+  const uint8_t *tile;
+  uint8_t       *dst;
+  int            y;
+  
+  tile = &MEM(0x8000 + bgcache_tile(gb, MEM(0x9800 + map*0x400 + entry)) * 16);
+  dst  = &cache.surface[map][(entry / 32) * 8][(entry % 32) * 8];
+  
+  for(y = 0; y < 8; ++y, tile += 2, dst += 256)
+    gb_decode_row(tile, dst);
+}
+
+/* Brings the surfaces up to date with every VRAM write seen so far. */
+static void bgcache_flush(gb_t *gb) {
+  int map, i;
+  
+  if(cache.stale) {
+    for(map = 0; map < 2; ++map)
+      for(i = 0; i < 1024; ++i)
+        bgcache_draw(gb, map, i);
+    
+    memset(cache.map_dirty,  0, sizeof cache.map_dirty);
+    memset(cache.tile_dirty, 0, sizeof cache.tile_dirty);
+    cache.stale = cache.pending = cache.tiles_pending = 0;
+    return;
+  }
+  
+  /* Changed tiles dirty every entry that refers to them. */
+  if(cache.tiles_pending) {
+    for(map = 0; map < 2; ++map) {
+      const uint8_t *entries = &MEM(0x9800 + map*0x400);
+      
+      for(i = 0; i < 1024; ++i) {
+        int t = bgcache_tile(gb, entries[i]);
+        if(cache.tile_dirty[t / 32] & (1u << (t % 32)))
+          cache.map_dirty[map][i / 32] |= 1u << (i % 32);
+      }
+    }
+    
+    memset(cache.tile_dirty, 0, sizeof cache.tile_dirty);
+    cache.tiles_pending = 0;
+  }
+  
+  for(map = 0; map < 2; ++map) {
+    for(i = 0; i < 1024/32; ++i) {
+      uint32_t bits = cache.map_dirty[map][i];
+      
+      while(bits) {
+        int b = __builtin_ctz(bits);
+        bits &= bits - 1;
+        bgcache_draw(gb, map, i*32 + b);
+      }
+      
+      cache.map_dirty[map][i] = 0;
+    }
+  }
+  
+  cache.pending = 0;
+}
+
+/* Starts over. A stale cache redraws its surfaces in full, so only the
+ * bookkeeping after them needs clearing, which keeps loading states and
+ * forking from touching 128 KB. */
+void bgcache_reset(gb_t *gb) {
+  memset(cache.map_dirty, 0, sizeof cache - offsetof(bgcache_t, map_dirty));
+  cache.enabled     = 1;
+  cache.active      = 1;
+  cache.stale       = 1;
+  cache.signed_data = !(LCDC & (1 << 4));
+}
+
+/* Turns the cache on or off. Disabled caches never become active. */
+void bgcache_enable(gb_t *gb, int enable) {
+  cache.enabled = !!enable;
+  if(!cache.enabled) {
+    cache.active = 0;
+    cache.stale  = 1;
+  }
+}
+
+/* Records a write to VRAM. Only called when the byte actually changed. */
+void bgcache_write(gb_t *gb, uint16_t addr) {
+  ++cache.writes;
+  
+  if(!cache.active)
+    return;
+  
+  /* Tile map entry. */
+  if(addr >= 0x9800) {
+    int map   = (addr - 0x9800) / 0x400;
+    int entry = (addr - 0x9800) % 0x400;
+    cache.map_dirty[map][entry / 32] |= 1u << (entry % 32);
+  }
+  
+  /* Tile data. */
+  else {
+    int t = (addr - 0x8000) / 16;
+    cache.tile_dirty[t / 32] |= 1u << (t % 32);
+    cache.tiles_pending = 1;
+  }
+  
+  cache.pending = 1;
+}
+
+/* Switching tile data addressing changes what every map entry refers to.
+ * Games that switch it mid-frame would have the cache rebuilt over and over,
+ * so the rebuilds count towards turning it off. */
+void bgcache_lcdc(gb_t *gb, uint8_t value) {
+  uint8_t signed_data = !(value & (1 << 4));
+  
+  if(signed_data != cache.signed_data) {
+    cache.signed_data = signed_data;
+    cache.stale       = 1;
+    cache.writes     += REBUILD_WRITES;
+  }
+}
+
+/* Called once per frame at VBlank to decide whether the cache should be used
+ * for the next frame, based on how much VRAM changed in this one. */
+void bgcache_frame(gb_t *gb) {
+  if(cache.writes > MAX_WRITES) {
+    cache.active = 0;
+    cache.quiet  = 0;
+  }
+  
+  else if(!cache.active && cache.enabled && (++cache.quiet >= QUIET_FRAMES)) {
+    cache.active = 1;
+    cache.stale  = 1;
+  }
+  
+  cache.writes = 0;
+}
+
+int bgcache_active(gb_t *gb) {
+  return cache.active;
+}
+
+/* Copies n pixels of the map at the given address, starting at surface
+ * coordinate (x, y) and wrapping around horizontally. */
+void bgcache_span(gb_t *gb, uint8_t *out, int n, uint16_t map, uint8_t x, uint8_t y) {
+  const uint8_t *row;
+  int            first;
+  
+  if(cache.pending || cache.stale)
+    bgcache_flush(gb);
+  
+  row   = cache.surface[map == 0x9c00][y];
+  first = 256 - x;
+  
+  if(first >= n) {
+    memcpy(out, row + x, n);
+  }
+  else {
+    memcpy(out, row + x, first);
+    memcpy(out + first, row, n - first);
+  }
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "cart.h"
+#include "fork.h"
+#include "gb.h"
+
+/* Cartridge RAM sizes by header byte 0x149. The 2 KB size is rounded up to
+ * a whole 8 KB bank. */
+static const size_t cart_ram_sizes[6] = {
+  0, 0x2000, 0x2000, 0x8000, 0x20000, 0x10000
+};
+
+static cart_mbc_t cart_type(uint8_t type) {
+  if((type >= 0x01) && (type <= 0x03)) return CART_MBC1;
+  if((type >= 0x05) && (type <= 0x06)) return CART_MBC2;
+  if((type >= 0x0f) && (type <= 0x13)) return CART_MBC3;
+  if((type >= 0x19) && (type <= 0x1e)) return CART_MBC5;
+  return CART_ROM;
+}
+
+/* Points a 16 KB window of the address space at a ROM bank. The pages are
+ * read straight from the shared image; writes never reach them, since PUT8
+ * hands everything below 0x8000 to cart_write(). */
+static void cart_map_rom(gb_t *gb, int page, unsigned int bank) {
+  const uint8_t *p = gb->cart.rom->data + (size_t)(bank % gb->cart.rom->banks) * 0x4000;
+  
+  z80_map(gb, page,     p,          gb->bus_sink);
+  z80_map(gb, page + 1, p + 0x1000, gb->bus_sink);
+}
+
+/* Maps the selected banks. */
+void cart_map(gb_t *gb) {
+  cart_t      *cart = &gb->cart;
+  unsigned int low  = 0, high = cart->bank, ram = cart->bank2;
+  
+  if(!cart->rom)
+    return;
+  
+  /* MBC1 keeps its upper bits in bank 2, which in mode 1 also select the
+   * bank at 0x0000 and the RAM bank. */
+  if(cart->mbc == CART_MBC1) {
+    high |= cart->bank2 << 5;
+    low   = cart->mode ? (cart->bank2 << 5) : 0;
+    ram   = cart->mode ? cart->bank2 : 0;
+  }
+  
+  cart_map_rom(gb, 0x0, low);
+  cart_map_rom(gb, 0x4, high);
+  
+  /* Without RAM of its own, the cartridge leaves 0xa000-0xbfff to instance
+   * memory. Disabled RAM, and MBC3's clock registers, read as open bus. */
+  if(!cart->ram) {
+    z80_map_page(gb, 0xa, &MEM(0xa000));
+    z80_map_page(gb, 0xb, &MEM(0xb000));
+  }
+  else if(!cart->ram_enabled || (ram * 0x2000 >= cart->ram_size)) {
+    z80_map(gb, 0xa, gb->open_bus, gb->bus_sink);
+    z80_map(gb, 0xb, gb->open_bus, gb->bus_sink);
+  }
+  else {
+    z80_map_page(gb, 0xa, cart->ram + ram * 0x2000);
+    z80_map_page(gb, 0xb, cart->ram + ram * 0x2000 + 0x1000);
+  }
+}
+
+/* Inserts a cartridge, taking a reference to its image and giving it zeroed
+ * RAM of its own. Whatever was inserted before is released. Returns 0 if
+ * memory runs out. */
+int cart_load(gb_t *gb, rom_t *rom) {
+  cart_t *cart = &gb->cart;
+  uint8_t size = rom->data[0x149];
+  
+  cart_release(gb);
+  cart->mbc      = cart_type(rom->data[0x147]);
+  cart->ram_size = (size < 6) ? cart_ram_sizes[size] : 0;
+  if(cart->mbc == CART_MBC2)
+    cart->ram_size = 0x2000;
+  
+  if(cart->ram_size && !(cart->ram = calloc(1, cart->ram_size)))
+    return 0;
+  
+  cart->rom = rom_ref(rom);
+  return 1;
+}
+
+/* Selects the first banks, as at power on. Called by gb_init(). */
+void cart_reset(gb_t *gb) {
+  cart_t *cart = &gb->cart;
+  
+  cart->bank        = 1;
+  cart->bank2       = 0;
+  cart->mode        = 0;
+  cart->ram_enabled = (cart->mbc == CART_ROM);
+  cart_map(gb);
+}
+
+/* Writes to 0x0000-0x7fff, which go to the bank controller. */
+void cart_write(gb_t *gb, uint16_t addr, uint8_t value) {
+  cart_t *cart = &gb->cart;
+  
+  switch(cart->mbc) {
+    case CART_ROM:
+      return;
+    
+    case CART_MBC1:
+      if(addr < 0x2000)      cart->ram_enabled = ((value & 0x0f) == 0x0a);
+      else if(addr < 0x4000) cart->bank        = (value & 0x1f) ? (value & 0x1f) : 1;
+      else if(addr < 0x6000) cart->bank2       = value & 3;
+      else                   cart->mode        = value & 1;
+      break;
+    
+    /* Address bit 8 tells the two registers apart. */
+    case CART_MBC2:
+      if(addr >= 0x4000)     return;
+      if(!(addr & 0x100))    cart->ram_enabled = ((value & 0x0f) == 0x0a);
+      else                   cart->bank        = (value & 0x0f) ? (value & 0x0f) : 1;
+      break;
+    
+    /* Latching the clock does nothing, as there is no clock. */
+    case CART_MBC3:
+      if(addr < 0x2000)      cart->ram_enabled = ((value & 0x0f) == 0x0a);
+      else if(addr < 0x4000) cart->bank        = (value & 0x7f) ? (value & 0x7f) : 1;
+      else if(addr < 0x6000) cart->bank2       = value;
+      else                   return;
+      break;
+    
+    /* Bank 0 can be selected at 0x4000, and there are 9 bits of it. */
+    case CART_MBC5:
+      if(addr < 0x2000)      cart->ram_enabled = ((value & 0x0f) == 0x0a);
+      else if(addr < 0x3000) cart->bank        = (cart->bank & 0x100) | value;
+      else if(addr < 0x4000) cart->bank        = (cart->bank & 0xff) | ((value & 1) << 8);
+      else if(addr < 0x6000) cart->bank2       = value & 0x0f;
+      else                   return;
+      break;
+  }
+  
+  cart_map(gb);
+}
+
+/* Drops the reference to the image and frees the RAM, along with any pages
+ * shared with forks, since slots are counted from the RAM's size. */
+void cart_release(gb_t *gb) {
+  cart_t *cart = &gb->cart;
+  
+  fork_drop(gb);
+  if(cart->rom)
+    rom_unref(cart->rom);
+  free(cart->ram);
+  
+  cart->rom      = NULL;
+  cart->ram      = NULL;
+  cart->ram_size = 0;
+}
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <nds.h>
+#include <string.h>
+
+#include "cgb.h"
+#include "gb.h"
+#include "sched.h"
+#include "z80.h"
+
+/* The CPU is held for 2050 M-cycles while the clock changes speed. */
+#define SPEED_SWITCH_CYCLES 8200
+
+/* An HDMA block of 16 bytes holds the CPU for 32 dots at either speed. */
+#define HDMA_BLOCK_DOTS 32
+
+#define cgb (gb->cgb)
+
+/* Points the banked pages at the selected VRAM and WRAM banks. */
+void cgb_map(gb_t *gb) {
+  uint8_t *vram = cgb.vram_bank ? cgb.vram1 : &MEM(0x8000);
+  uint8_t *wram = (cgb.wram_bank > 1) ? cgb.wram[cgb.wram_bank - 2] : &MEM(0xd000);
+  
+  z80_map_page(gb, 0x8, vram);
+  z80_map_page(gb, 0x9, vram + 0x1000);
+  z80_map_page(gb, 0xd, wram);
+}
+
+/* Recomputes the output color of palette byte i. */
+static void cgb_lut(const uint8_t *pal, uint16_t *lut, int i) {
+  uint16_t c = pal[i & ~1] | (pal[i | 1] << 8);
+  
+  lut[i / 2] = RGB15(c & 31, (c >> 5) & 31, (c >> 10) & 31);
+}
+
+/* Resets to the power-on state. In DMG mode the registers are left alone and
+ * only the default banks are mapped. */
+void cgb_init(gb_t *gb, int enabled) {
+  int i;
+  
+  memset(&cgb, 0, sizeof cgb);
+  cgb.enabled   = !!enabled;
+  cgb.wram_bank = 1;
+  cgb_map(gb);
+  sched_cancel(gb, SCHED_HDMA);
+  
+  if(!cgb.enabled)
+    return;
+  
+  /* Every color starts out white. */
+  memset(cgb.bg_pal,  0xff, sizeof cgb.bg_pal);
+  memset(cgb.obj_pal, 0xff, sizeof cgb.obj_pal);
+  for(i = 0; i < 64; i += 2) {
+    cgb_lut(cgb.bg_pal,  cgb.lut,      i);
+    cgb_lut(cgb.obj_pal, cgb.lut + 32, i);
+  }
+  
+  KEY1  = 0x7e;
+  VBK   = 0xfe;
+  HDMA5 = 0xff;
+  BCPS  = 0x40;
+  BCPD  = cgb.bg_pal[0];
+  OCPS  = 0x40;
+  OCPD  = cgb.obj_pal[0];
+  SVBK  = 0xf9;
+}
+
+/* Copies blocks of 16 bytes from the HDMA source to VRAM, a page at a time,
+ * and advances both addresses. */
+static void cgb_copy(gb_t *gb, int blocks) {
+  int n = blocks * 16;
+  
+  if(gb->lcd_pending) gb_lcd_flush(gb);
+  gb->lcd_dirty = 1;
+  
+  while(n > 0) {
+    uint16_t src   = cgb.hdma_src;
+    uint16_t dst   = 0x8000 | (cgb.hdma_dst & 0x1fff);
+    int      count = n;
+    
+    if(count > 0x1000 - (src & 0xfff)) count = 0x1000 - (src & 0xfff);
+    if(count > 0x1000 - (dst & 0xfff)) count = 0x1000 - (dst & 0xfff);
+    
+    memcpy(&gb->wmapped[dst >> 12][dst & 0xfff], &gb->mapped[src >> 12][src & 0xfff], count);
+    cgb.hdma_src += count;
+    cgb.hdma_dst += count;
+    n            -= count;
+  }
+}
+
+/* Moves one block per HBlank of a visible line. */
+void cgb_hblank(gb_t *gb) {
+  if((LCDC & 0x80) && (LY < 144)) {
+    cgb_copy(gb, 1);
+    gb_stall(gb, HDMA_BLOCK_DOTS << cgb.speed);
+    
+    if(!--cgb.hdma_blocks) {
+      cgb.hdma_active = 0;
+      HDMA5           = 0xff;
+      return;
+    }
+    HDMA5 = cgb.hdma_blocks - 1;
+  }
+  
+  sched_at(gb, SCHED_HDMA, gb_next_hblank(gb));
+}
+
+/* Starts or stops an HDMA transfer. General-purpose transfers happen at once
+ * while the CPU waits; HBlank transfers are scheduled a block at a time. */
+static void cgb_hdma(gb_t *gb, uint8_t value) {
+  /* Writing bit 7 clear stops an HBlank transfer. */
+  if(cgb.hdma_active && !(value & 0x80)) {
+    cgb.hdma_active = 0;
+    HDMA5           = 0x80 | (cgb.hdma_blocks - 1);
+    sched_cancel(gb, SCHED_HDMA);
+    return;
+  }
+  
+  cgb.hdma_src    = ((HDMA1 << 8) | HDMA2) & 0xfff0;
+  cgb.hdma_dst    = ((HDMA3 << 8) | HDMA4) & 0x1ff0;
+  cgb.hdma_blocks = (value & 0x7f) + 1;
+  
+  if(!(value & 0x80)) {
+    cgb_copy(gb, cgb.hdma_blocks);
+    gb_stall(gb, (cgb.hdma_blocks * HDMA_BLOCK_DOTS) << cgb.speed);
+    cgb.hdma_blocks = 0;
+    HDMA5           = 0xff;
+    return;
+  }
+  
+  cgb.hdma_active = 1;
+  HDMA5           = value & 0x7f;
+  sched_at(gb, SCHED_HDMA, gb_next_hblank(gb));
+}
+
+/* Writes palette data at the index in spec, auto-incrementing it if asked.
+ * Lines still waiting to be rendered are drawn with the old colors first. */
+static void cgb_palette(gb_t *gb, uint8_t *spec, uint8_t *data, uint8_t *pal,
+                        uint16_t *lut, uint8_t value) {
+  int i = *spec & 0x3f;
+  
+  if(pal[i] != value) {
+    if(gb->lcd_pending) gb_lcd_flush(gb);
+    pal[i]        = value;
+    gb->lcd_dirty = 1;
+    cgb_lut(pal, lut, i);
+  }
+  
+  if(*spec & 0x80)
+    *spec = 0xc0 | ((i + 1) & 0x3f);
+  *data = pal[*spec & 0x3f];
+}
+
+/* Handles a write to 0xff4d-0xff70 in CGB mode. Reads of these registers go
+ * to memory, which is kept holding what they read back as. */
+void cgb_write(gb_t *gb, uint16_t addr, uint8_t value) {
+  switch(addr) {
+    case 0xff4d:
+      KEY1 = (KEY1 & 0x80) | 0x7e | (value & 1);
+      break;
+    
+    case 0xff4f:
+      cgb.vram_bank = value & 1;
+      VBK           = 0xfe | cgb.vram_bank;
+      cgb_map(gb);
+      break;
+    
+    case 0xff55:
+      cgb_hdma(gb, value);
+      break;
+    
+    case 0xff68:
+      BCPS = value | 0x40;
+      BCPD = cgb.bg_pal[value & 0x3f];
+      break;
+    
+    case 0xff69:
+      cgb_palette(gb, &BCPS, &BCPD, cgb.bg_pal, cgb.lut, value);
+      break;
+    
+    case 0xff6a:
+      OCPS = value | 0x40;
+      OCPD = cgb.obj_pal[value & 0x3f];
+      break;
+    
+    case 0xff6b:
+      cgb_palette(gb, &OCPS, &OCPD, cgb.obj_pal, cgb.lut + 32, value);
+      break;
+    
+    case 0xff70:
+      cgb.wram_bank = (value & 7) ? (value & 7) : 1;
+      SVBK          = 0xf8 | (value & 7);
+      cgb_map(gb);
+      break;
+    
+    default:
+      MEM(addr) = value;
+      break;
+  }
+}
+
+/* Called on STOP. Switches speed if KEY1 asked for it and returns 1, or
+ * returns 0 if STOP should halt as usual. */
+int cgb_stop(gb_t *gb) {
+  if(!cgb.enabled || !(KEY1 & 1))
+    return 0;
+  
+  cgb.speed ^= 1;
+  KEY1       = (cgb.speed << 7) | 0x7e;
+  gb_stall(gb, SPEED_SWITCH_CYCLES);
+  return 1;
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "fork.h"
+#include "gb.h"
+#include "z80.h"
+
+/* Children may run on other threads, so references are counted
+ * atomically there. */
+#ifdef ORCHARD_THREADS
+#define REF(page)   __atomic_add_fetch(&(page)->refs, 1, __ATOMIC_RELAXED)
+#define UNREF(page) __atomic_sub_fetch(&(page)->refs, 1, __ATOMIC_ACQ_REL)
+#else
+#define REF(page)   (++(page)->refs)
+#define UNREF(page) (--(page)->refs)
+#endif
+
+/* Slots 0-3 are 0xa000-0xdfff in instance memory, 4-9 the CGB's WRAM banks
+ * and the rest the cartridge RAM, whose sizes are all whole pages. */
+int fork_slots(gb_t *gb) {
+  return 10 + (int)(gb->cart.ram_size / FORK_PAGE);
+}
+
+/* The instance's own memory for a slot. */
+uint8_t *fork_own(gb_t *gb, int slot) {
+  if(slot < 4)  return &MEM(0xa000 + slot * FORK_PAGE);
+  if(slot < 10) return gb->cgb.wram[slot - 4];
+  return gb->cart.ram + (slot - 10) * FORK_PAGE;
+}
+
+/* What a slot holds now. */
+const uint8_t *fork_data(gb_t *gb, int slot) {
+  return gb->fork.stale[slot] ? gb->fork.page[slot]->data : fork_own(gb, slot);
+}
+
+static void fork_unref(fork_page_t *page) {
+  if(!UNREF(page)) free(page);
+}
+
+/* Has child share one of parent's slots, copying the slot into a page of
+ * its own the first time. Out of memory, the child gets a copy instead.
+ * Neither instance's page tables change here; both are remapped after. */
+void fork_share(gb_t *child, gb_t *parent, int slot) {
+  fork_page_t *page = parent->fork.page[slot];
+  
+  if(!page) {
+    if(!(page = malloc(sizeof *page))) {
+      memcpy(fork_own(child, slot), fork_own(parent, slot), FORK_PAGE);
+      return;
+    }
+    page->refs = 1;
+    memcpy(page->data, fork_own(parent, slot), FORK_PAGE);
+    parent->fork.page[slot]  = page;
+    parent->fork.stale[slot] = 0;
+    ++parent->fork.held;
+  }
+  
+  REF(page);
+  child->fork.page[slot]  = page;
+  child->fork.stale[slot] = 1;
+  ++child->fork.held;
+}
+
+/* Called by z80_map() while slots are shared. A page mapping a shared slot
+ * reads from the shared copy if the instance's own is stale, and has no
+ * write mapping, so the first write comes to fork_write(). */
+void fork_map(gb_t *gb, int page, const uint8_t **read, uint8_t **write) {
+  fork_t *f     = &gb->fork;
+  int     slots = fork_slots(gb);
+  int     slot;
+  
+  f->slot_of[page] = -1;
+  if((page < 0xa) || (page > 0xe))
+    return;
+  
+  for(slot = 0; slot < slots; ++slot) {
+    if(*write != fork_own(gb, slot))
+      continue;
+    
+    if(f->page[slot]) {
+      f->slot_of[page] = slot;
+      if(f->stale[slot]) *read = f->page[slot]->data;
+      *write = NULL;
+    }
+    return;
+  }
+}
+
+/* Takes the first write to a shared page: the instance gets its own memory
+ * back, up to date, and every page mapping the slot points at it again.
+ * Returns where the write goes. */
+uint8_t *fork_write(gb_t *gb, int page) {
+  fork_t  *f    = &gb->fork;
+  int      slot = f->slot_of[page];
+  uint8_t *own  = fork_own(gb, slot);
+  int      i;
+  
+  if(f->stale[slot]) {
+    memcpy(own, f->page[slot]->data, FORK_PAGE);
+    ++f->copies;
+  }
+  fork_unref(f->page[slot]);
+  f->page[slot]  = NULL;
+  f->stale[slot] = 0;
+  --f->held;
+  
+  for(i = 0xa; i <= 0xe; ++i) {
+    if(f->slot_of[i] == slot) {
+      f->slot_of[i] = -1;
+      z80_map(gb, i, own, own);
+    }
+  }
+  return gb->wpages[page];
+}
+
+/* Lets go of every shared copy without keeping what it holds, for memory
+ * about to be replaced or freed. The page tables still point at the copies
+ * until the instance is remapped. */
+void fork_drop(gb_t *gb) {
+  fork_t *f = &gb->fork;
+  int     slot;
+  
+  for(slot = 0; slot < FORK_SLOTS; ++slot) {
+    if(f->page[slot]) fork_unref(f->page[slot]);
+    f->page[slot]  = NULL;
+    f->stale[slot] = 0;
+  }
+  f->held = 0;
+}
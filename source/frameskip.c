@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "frameskip.h"
+
+/* The Game Boy draws 4194304 / 70224 frames per second, about 59.73. */
+#define GB_CLOCK     4194304
+#define FRAME_CYCLES 70224
+
+/* Consecutive on-time frames before the skip level is lowered again. */
+#define RECOVER_FRAMES 60
+
+/* Lag beyond this many frames can't be made up by skipping and is dropped. */
+#define MAX_LAG_FRAMES 2
+
+static struct {
+  frameskip_clock_t clock;
+  uint32_t          ticks_per_sec;
+  uint32_t          budget;
+  uint32_t          start;
+  int32_t           lag;
+  int               max_skip;
+  int               level;
+  int               skipped;
+  int               rendered;
+  int               on_time;
+} fs;
+
+frameskip_stats_t frameskip_stats;
+
+/* Sets up the controller. max_skip bounds how many frames in a row may go
+ * unrendered; 0 disables skipping but keeps the measurements. */
+void frameskip_init(frameskip_clock_t clock, uint32_t ticks_per_sec, int max_skip) {
+  memset(&fs, 0, sizeof fs);
+  memset(&frameskip_stats, 0, sizeof frameskip_stats);
+  
+  fs.clock         = clock;
+  fs.ticks_per_sec = ticks_per_sec;
+  fs.budget        = (uint64_t)ticks_per_sec * FRAME_CYCLES / GB_CLOCK;
+  fs.max_skip      = max_skip;
+}
+
+/* Called before emulating a frame. Returns 1 if the frame should be
+ * rendered, 0 if only its logic should run. */
+int frameskip_begin(void) {
+  int render = (fs.skipped >= fs.level);
+  
+  fs.skipped  = render ? 0 : fs.skipped + 1;
+  fs.rendered = render;
+  fs.start    = fs.clock();
+  
+  ++frameskip_stats.frames;
+  if(!render) ++frameskip_stats.skipped_frames;
+  
+  return render;
+}
+
+/* Called once the frame has been emulated, before waiting for the display.
+ * Time spent over budget accumulates as lag; time under budget is lost to
+ * the wait, so lag never goes negative. */
+void frameskip_end(void) {
+  uint32_t elapsed = fs.clock() - fs.start;
+  uint32_t ms      = (uint64_t)elapsed * 1000 / fs.ticks_per_sec;
+  
+  ++frameskip_stats.histogram[(ms < FRAMESKIP_BUCKETS) ? ms : FRAMESKIP_BUCKETS - 1];
+  
+  fs.lag += (int32_t)(elapsed - fs.budget);
+  if(fs.lag < 0) fs.lag = 0;
+  if(fs.lag > (int32_t)(MAX_LAG_FRAMES * fs.budget)) fs.lag = MAX_LAG_FRAMES * fs.budget;
+  
+  /* More than a frame behind after drawing one: skip more. */
+  if(fs.lag > (int32_t)fs.budget) {
+    if(fs.rendered && (fs.level < fs.max_skip)) ++fs.level;
+    fs.on_time = 0;
+  }
+  
+  /* Caught up for a while: skip less. */
+  else if(!fs.lag && fs.level && (++fs.on_time >= RECOVER_FRAMES)) {
+    --fs.level;
+    fs.on_time = 0;
+  }
+}
+
+/* Returns how many frames are currently skipped for every one rendered. */
+int frameskip_level(void) {
+  return fs.level;
+}
@@ -26,8 +26,20 @@
 #include <nds.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef ORCHARD_THREADS
+#include <pthread.h>
+#endif
 
+#include "apu.h"
+#include "bgcache.h"
+#include "cart.h"
+#include "cgb.h"
 #include "gb.h"
+#include "joypad.h"
+#include "sched.h"
+#include "serial.h"
 #include "z80.h"
 
 #define MAX_CYCLES    70221
@@ -42,33 +54,29 @@ typedef enum {
   intr_vblank = (1 << 0),
   intr_lcd    = (1 << 1),
   intr_timer  = (1 << 2),
+  intr_serial = (1 << 3),
   intr_pad    = (1 << 4)
 } intr_t;
 
-uint8_t bank_count       = 0;
-uint8_t (*banks)[0x4000] = NULL;
-unsigned int cur_bank    = 0;
 FILE *logfile;
 
-static int timer_counter;
-static int scanline = 0;
-
-static void gb_draw_scanline(void);
-static void gb_service    (intr_t i);
-static void gb_check_intrs(void);
-static void gb_update     (uint8_t cycles);
-static void gb_set_lcd    (void);
+static void gb_draw_scanline(gb_t *gb);
+static void gb_service    (gb_t *gb, intr_t i);
+static inline void gb_check_intrs(gb_t *gb);
+static inline void gb_update     (gb_t *gb, int cycles, int dots);
+static inline void gb_set_lcd(gb_t *gb);
 static uint16_t gb_get_color(uint8_t num, uint8_t palette);
-static void gb_render_tile(uint8_t x, uint8_t y, uint8_t tile[2]);
+static void gb_lcd_frame(gb_t *gb);
 
-void gb_init(void) {
+void gb_init(gb_t *gb) {
   /* Initialize registers. */
-  AF = 0x01b0;
-  BC = 0x0013;
-  DE = 0x00d8;
-  HL = 0x014d;
-  SP = 0xfffe;
-  PC = 0x0100;
+  AF  = 0x01b0;
+  BC  = 0x0013;
+  DE  = 0x00d8;
+  HL  = 0x014d;
+  SP  = 0xfffe;
+  PC  = 0x0100;
+  IME = 1;
 
   /* Initialize memory-mapped registers. */
   TIMA = 0x00;
@@ -102,30 +110,87 @@ void gb_init(void) {
   WY   = 0x00;
   WX   = 0x00;
   IE   = 0x00;
+  
+  /* Games tell a CGB from A after boot. */
+  sched_reset(gb);
+  z80_init(gb);
+  cart_reset(gb);
+  cgb_init(gb, GET8(0x143) & 0x80);
+  if(gb->cgb.enabled) A = 0x11;
+  gb->stall = 0;
+  apu_reset(gb);
+  joypad_reset(gb);
+  serial_reset(gb);
+  
+  /* The background cache only knows DMG tiles. */
+  bgcache_reset(gb);
+  if(gb->cgb.enabled) bgcache_enable(gb, 0);
+  gb->obj_cache.oam = NULL;
+  gb_lcdc_write(gb, LCDC);
+  gb->lcd_dirty   = 1;
+  gb->lcd_pending = 0;
+  gb->log_first   = 0;
+  gb->log_end     = 0;
+  
+  /* Timers and the LCD start over, and every line gets drawn. */
+  gb->timer_counter  = 0;
+  gb->div_counter    = 0;
+  gb->scanline       = 0;
+  gb->window_line    = 0;
+  gb->frame_drawn    = 0;
+  gb->frame_changed  = 1;
+  gb->have_frame_log = 0;
+  memset(gb->drawn, 0, sizeof gb->drawn);
+  
+  /* Lines go to the DS screen unless told otherwise. */
+  if(!gb->frame)
+    gb_set_framebuffer(gb, &VRAM_A[23*SCREEN_WIDTH + 47], SCREEN_WIDTH);
 }
 
-void gb_run(void) {
+/* Runs for a frame's worth of dots. In double-speed mode the CPU and timers
+ * get two cycles for every dot. Only CGB mode can switch speed or have the
+ * CPU held by HDMA, so DMG games run a loop without either. */
+static inline __attribute__((always_inline)) void gb_run_variant(gb_t *gb, const int cgb_mode) {
   uint32_t cycles = 0;
   
   while(cycles < MAX_CYCLES) {
     /* Execute next opcode and increase cycle count. */
-    uint8_t t_cycles = z80_execute();
-    cycles          += t_cycles;
+    int t_cycles = z80_execute(gb);
+    int dots     = t_cycles;
+    
+    if(cgb_mode) {
+      if(gb->stall) {
+        t_cycles  += gb->stall;
+        gb->stall  = 0;
+      }
+      dots = t_cycles >> gb->cgb.speed;
+    }
+    cycles += dots;
     
     /* Update timers and graphics. */
-    gb_update(t_cycles);
+    gb_update(gb, t_cycles, dots);
     
     /* Check for interrupts and handle them if necessary. */
-    gb_check_intrs();
+    gb_check_intrs(gb);
   }
 }
 
+void gb_run(gb_t *gb) {
+  if(gb->cgb.enabled) gb_run_variant(gb, 1);
+  else                gb_run_variant(gb, 0);
+  
+  /* Sound is synthesized once a frame, and the joypad checked for presses
+   * the game hasn't read. */
+  apu_frame(gb);
+  joypad_poll(gb);
+}
+
 /* Requests a given interrupt. */
-void gb_intr(intr_t i) {
+void gb_intr(gb_t *gb, intr_t i) {
   IF |= i;
 }
 
-void gb_check_intrs(void) {
+static inline __attribute__((always_inline)) void gb_check_intrs(gb_t *gb) {
   /* Only service interrupts if interrupts are enabled. */
   if(IME) {
     /* Only service interrupts if there are actually any. */
@@ -135,7 +200,7 @@ void gb_check_intrs(void) {
       /* Check each interrupt. */
       for(i = 0; i < 5; ++i) {
         if(TESTBIT(IE, i) && TESTBIT(IF, i)) {
-          gb_service((1 << i));
+          gb_service(gb, (1 << i));
         }
       }
     }
@@ -143,7 +208,7 @@ void gb_check_intrs(void) {
 }
 
 /* Services an interrupt. */
-void gb_service(intr_t i) {
+void gb_service(gb_t *gb, intr_t i) {
   
   /* Disable interrupts and clear requested interrupt. */
   IME = 0;
@@ -157,32 +222,42 @@ void gb_service(intr_t i) {
     case intr_vblank: PC = 0x40; break;
     case intr_lcd:    PC = 0x48; break;
     case intr_timer:  PC = 0x50; break;
+    case intr_serial: PC = 0x58; break;
     case intr_pad:    PC = 0x60; break;
   }
 }
 
-void gb_update(uint8_t cycles) {
-  static int div_reg  = 0;
-  
+/* Holds the CPU for the given number of CPU cycles, on top of the current
+ * instruction. */
+void gb_stall(gb_t *gb, int cycles) {
+  gb->stall += cycles;
+}
+
+/* Returns the number of dots until the next line's HBlank. */
+uint32_t gb_next_hblank(gb_t *gb) {
+  return 456 - gb->scanline;
+}
+
+static inline __attribute__((always_inline)) void gb_update(gb_t *gb, int cycles, int dots) {
   /* Update division register. */
-  div_reg += cycles;
-  if(div_reg >= 255) {
-    div_reg = 0;
-    z80_memory[0xff04]++;
+  gb->div_counter += cycles;
+  if(gb->div_counter >= 255) {
+    gb->div_counter = 0;
+    MEM(0xff04)++;
   }
   
   /* Only update the clock if it's active. */
   if(TESTBIT(TAC, 2)) {
-    timer_counter -= cycles;
+    gb->timer_counter -= cycles;
     
     /* If the timer has underflowed, update it. */
-    if(timer_counter <= 0) {
-      gb_set_clock();
+    if(gb->timer_counter <= 0) {
+      gb_set_clock(gb);
       
       /* Request interrupt on timer overflow. */
       if(TIMA == 255) {
         TIMA = TMA;
-        gb_intr(intr_timer);
+        gb_intr(gb, intr_timer);
       }
       
       else {
@@ -192,101 +267,387 @@ void gb_update(uint8_t cycles) {
   }
   
   /* Only update the LCD if it's active. */
-  gb_set_lcd();
+  gb_set_lcd(gb);
   if(TESTBIT(LCDC, 7)) {
-    scanline += cycles;
+    gb->scanline += dots;
     
-    if(scanline >= 456) {
-      scanline = 0;
+    if(gb->scanline >= 456) {
+      gb->scanline = 0;
       ++LY;
       
       /* We've entered VBlank. */
       if(LY == 144) {
-        gb_intr(intr_vblank);
+        gb_intr(gb, intr_vblank);
+        gb_lcd_frame(gb);
+        bgcache_frame(gb);
       }
       
       /* Reset scanline. */
-      else if(LY > 153) LY = 0;
+      else if(LY > 153) {
+        LY              = 0;
+        gb->window_line = 0;
+      }
       
       /* Draw current scanline. */
-      if(LY < 144) gb_draw_scanline();
+      if(LY < 144) gb_draw_scanline(gb);
     }
   }
+  
+  sched_advance(gb, dots);
 }
 
 /* Set the clock to a given frequency. */
-void gb_set_clock() {
+void gb_set_clock(gb_t *gb) {
   switch(TAC & 0x3) {
-    case 0: timer_counter = 1024; break;
-    case 1: timer_counter = 16;   break;
-    case 2: timer_counter = 64;   break;
-    case 3: timer_counter = 256;  break;
+    case 0: gb->timer_counter = 1024; break;
+    case 1: gb->timer_counter = 16;   break;
+    case 2: gb->timer_counter = 64;   break;
+    case 3: gb->timer_counter = 256;  break;
   }
 }
 
-void gb_render_tiles() {
-  uint8_t  y, i, WXD;
-  uint16_t tile_addr = 0x8000;
-  uint16_t bg_addr;
-  int      use_window  = 0;
-  int      signed_data = 0;
+/* Returns the two bytes of the given tile's row that land on map row y. Tile
+ * data either starts at 0x8000 with unsigned indices, or is centered on 0x9000
+ * with signed indices. */
+static inline const uint8_t *gb_tile_row(gb_t *gb, const int unsigned_data,
+                                         uint8_t index, uint8_t y) {
+  uint16_t addr;
   
-  /* If the window is enabled and lower/equal to the current scanline. */
-  if(TESTBIT(LCDC, 5) && (WY <= LY)) use_window = 1;
+  if(unsigned_data) addr = 0x0000 + index * 16;
+  else              addr = 0x1000 + (int8_t)index * 16;
   
-  /* Calculate tile address. */
-  if(!TESTBIT(LCDC, 4)) {
-    tile_addr += 0x800;
-    signed_data = 1;
-  }
+  return &gb->render_vram[addr + (y % 8) * 2]; /* Each line is 2 bytes wide. */
+}
+
+/* Decodes a 2-byte tile row into 8 color numbers, leftmost pixel first. */
+void gb_decode_row(const uint8_t *row, uint8_t *out) {
+  int i;
   
-  /* Calculate background address. */
-  bg_addr = TESTBIT(LCDC, use_window ? 6 : 3) ? 0x9c00 : 0x9800;
+  for(i = 7; i >= 0; --i)
+    *out++ = (BITVAL(row[1], i) << 1) | BITVAL(row[0], i);
+}
+
+/* Renders pixels [start, end) of a line into the line buffer from the tile
+ * map at map, starting at map coordinate (x, y). Tile rows are decoded eight
+ * pixels at a time; only the first and last tiles of a span can be partially
+ * visible. */
+static inline void gb_render_span(gb_t *gb, const int unsigned_data, int start, int end,
+                                  uint16_t map, uint8_t x, uint8_t y) {
+  const uint8_t *row  = &gb->render_vram[map - 0x8000 + (y / 8) * 32];
+  uint8_t       *out  = &gb->line_buffer[start];
+  uint8_t        tx   = x / 8;
+  int            skip = x % 8;
+  int            n    = end - start;
   
-  /* Adjust window. */
-  WXD = WX;
+  /* Mostly static maps are copied from their pre-rendered surfaces, drawn
+   * with the tile data addressing LCDC has now; a line captured with the
+   * other one walks its tiles. */
+  if(gb->render_cached && bgcache_active(gb) && (unsigned_data != gb->bgcache.signed_data)) {
+    bgcache_span(gb, out, n, map, x, y);
+    return;
+  }
   
-  /* Calculate y position. */
-  y = use_window ? LY - WY : SCY + LY;
-  //iprintf("LY: %u, y: %u\n", LY, y);
-  //do { scanKeys(); } while(!(keysDown() & KEY_A));
+  while(n > 0) {
+    uint8_t        px[8];
+    const uint8_t *tile = gb_tile_row(gb, unsigned_data, row[tx++ & 31], y);
+    int            count;
+    
+    /* Whole tiles are decoded straight into the line buffer. */
+    if(!skip && n >= 8) {
+      gb_decode_row(tile, out);
+      out += 8;
+      n   -= 8;
+      continue;
+    }
+    
+    gb_decode_row(tile, px);
+    count = 8 - skip;
+    if(count > n) count = n;
+    memcpy(out, px + skip, count);
+    out  += count;
+    n    -= count;
+    skip  = 0;
+  }
+}
+
+/* Renders pixels [start, end) of a line in CGB mode, where each map entry has
+ * an attribute byte in VRAM bank 1 picking its palette, tile bank, flips and
+ * priority over sprites. */
+static inline void gb_render_span_cgb(gb_t *gb, const int unsigned_data, int start, int end,
+                                      uint16_t map, uint8_t x, uint8_t y) {
+  const uint8_t *row   = &gb->render_vram [map - 0x8000 + (y / 8) * 32];
+  const uint8_t *attrs = &gb->render_vram1[map - 0x8000 + (y / 8) * 32];
+  uint8_t       *out   = &gb->line_buffer[start];
+  uint8_t       *prio  = &gb->line_priority[start];
+  uint8_t        tx    = x / 8;
+  int            skip  = x % 8;
+  int            n     = end - start;
   
-  /* Draw scanline. */
-  for(i = 0; i < 160; i += 8) {
-    int      index;
-    uint8_t  x, line, tile[2];
-    uint16_t actual_addr;
+  while(n > 0) {
+    uint8_t        attr  = attrs[tx & 31];
+    uint8_t        index = row[tx++ & 31];
+    const uint8_t *bank  = TESTBIT(attr, 3) ? gb->render_vram1 : gb->render_vram;
+    uint8_t        ty    = TESTBIT(attr, 6) ? 7 - (y % 8) : (y % 8);
+    uint8_t        base  = (attr & 7) * 4;
+    uint8_t        px[8];
+    int            count, i;
     
-    /* Calculate x position. */
-    x = (use_window && (i >= WXD)) ? i - WXD : i + SCX;
+    if(unsigned_data) gb_decode_row(&bank[0x0000 + index * 16 + ty * 2], px);
+    else              gb_decode_row(&bank[0x1000 + (int8_t)index * 16 + ty * 2], px);
     
-    /* Find the given tile. */
-    actual_addr = bg_addr + x/8 + (y/8 * 32);
-    index       = signed_data ? (int8_t)GET8(actual_addr) + 128 : GET8(actual_addr);
-    actual_addr = tile_addr + index * 16; /* Each tile is 16 bytes wide. */
+    count = 8 - skip;
+    if(count > n) count = n;
     
-    /* Calculate the line to render, and retrieve it. */
-    line = (y % 8) * 2; /* Each line is 2 bytes wide. */
-    tile[0] = GET8(actual_addr + line);
-    tile[1] = GET8(actual_addr + line + 1);
+    for(i = 0; i < count; ++i) {
+      out[i]  = base + px[TESTBIT(attr, 5) ? 7 - (skip + i) : skip + i];
+      prio[i] = attr & 0x80;
+    }
     
-    /* Render the tile. */
-    gb_render_tile(i, y, tile);
+    out  += count;
+    prio += count;
+    n    -= count;
+    skip  = 0;
+  }
+}
+
+/* Returns where the window starts on line ly, or 160 if it isn't shown. The
+ * window starts at WX-7 and covers the rest of the line. */
+static int gb_window_split(const gb_line_regs_t *r, int ly) {
+  int wx = r->wx - 7;
+  
+  if(!TESTBIT(r->lcdc, 5) || (r->wy > ly) || (wx >= 160))
+    return 160;
+  
+  return (wx < 0) ? 0 : wx;
+}
+
+/* Rebuilds the per-line sprite lists from OAM. Each line gets the first ten
+ * sprites in OAM order that cover it, sorted by drawing priority: lower X
+ * first, then lower OAM index. In CGB mode only OAM order counts. */
+static void gb_build_sprites(gb_t *gb, const int tall, const int cgb_mode) {
+  int i, height = tall ? 16 : 8;
+  
+  memset(gb->obj_cache.count, 0, sizeof gb->obj_cache.count);
+  
+  for(i = 0; i < 40; ++i) {
+    const uint8_t *obj = &gb->render_oam[i * 4];
+    int            y   = obj[0] - 16;
+    int            ly;
+    
+    for(ly = (y < 0) ? 0 : y; (ly < y + height) && (ly < 144); ++ly) {
+      uint8_t *list = gb->obj_cache.lines[ly];
+      int      n    = gb->obj_cache.count[ly];
+      
+      if(n == 10)
+        continue;
+      
+      /* Insert by X; equal X keeps OAM order. */
+      while(!cgb_mode && n > 0 && gb->render_oam[list[n-1] * 4 + 1] > obj[1]) {
+        list[n] = list[n-1];
+        --n;
+      }
+      list[n] = i;
+      ++gb->obj_cache.count[ly];
+    }
   }
+  
+  gb->obj_cache.oam   = gb->render_oam;
+  gb->obj_cache.epoch = gb->render_epoch;
+  gb->obj_cache.tall  = tall;
 }
 
-static void gb_render_tile(uint8_t x, uint8_t y, uint8_t tile[2]) {
+/* Draws the sprites on line ly over the background in the line buffer.
+ * Sprite pixels are stored as 4 + palette*4 + color, so the blit can tell
+ * them from background color numbers. The highest-priority opaque sprite
+ * pixel claims its position even when it ends up behind the background.
+ * In CGB mode sprites are 32 + palette*4 + color, can come from either VRAM
+ * bank, and always win when master (LCDC bit 0) is clear. */
+static inline void gb_render_sprites(gb_t *gb, const int tall, int ly, const int cgb_mode,
+                                     const int master) {
+  uint8_t claimed[160];
   int     i;
-  uint8_t color;
   
-  for(i = 7; i >= 0; --i) {
-    color = (BITVAL(tile[1], i) << 1) | BITVAL(tile[0], i);
-    VRAM_A[(23+y)*SCREEN_WIDTH + x + (7 - i) + 47] = gb_get_color(color, BGP);
+  if((gb->obj_cache.oam != gb->render_oam) || (gb->obj_cache.epoch != gb->render_epoch) ||
+     (gb->obj_cache.tall != tall))
+    gb_build_sprites(gb, tall, cgb_mode);
+  
+  if(!gb->obj_cache.count[ly])
+    return;
+  
+  memset(claimed, 0, sizeof claimed);
+  
+  for(i = 0; i < gb->obj_cache.count[ly]; ++i) {
+    const uint8_t *obj   = &gb->render_oam[gb->obj_cache.lines[ly][i] * 4];
+    int            x     = obj[1] - 8;
+    int            row   = ly - (obj[0] - 16);
+    uint8_t        tile  = tall ? (obj[2] & 0xfe) : obj[2];
+    uint8_t        attrs = obj[3];
+    const uint8_t *bank  = gb->render_vram;
+    uint8_t        base  = 4 + (TESTBIT(attrs, 4) ? 4 : 0);
+    uint8_t        px[8];
+    int            j;
+    
+    if(cgb_mode) {
+      if(TESTBIT(attrs, 3)) bank = gb->render_vram1;
+      base = 32 + (attrs & 7) * 4;
+    }
+    
+    if(TESTBIT(attrs, 6)) row = (tall ? 15 : 7) - row;
+    gb_decode_row(&bank[tile * 16 + row * 2], px);
+    
+    for(j = 0; j < 8; ++j) {
+      int     sx    = x + (TESTBIT(attrs, 5) ? 7 - j : j);
+      uint8_t color = px[j];
+      
+      if(!color || (sx < 0) || (sx >= 160) || claimed[sx])
+        continue;
+      
+      claimed[sx] = 1;
+      if(cgb_mode) {
+        if(!master || !(gb->line_buffer[sx] & 3) ||
+           (!TESTBIT(attrs, 7) && !gb->line_priority[sx]))
+          gb->line_buffer[sx] = base + color;
+      }
+      else if(!TESTBIT(attrs, 7) || !gb->line_buffer[sx])
+        gb->line_buffer[sx] = base + color;
+    }
   }
 }
 
+/* Translates the line buffer through the background and sprite palettes into
+ * the framebuffer. CGB colors come straight from the palette LUT. */
+static inline void gb_blit_line(gb_t *gb, const gb_line_regs_t *r, int ly,
+                                const int cgb_mode) {
+  const uint8_t  *src = gb->line_buffer;
+  uint16_t        colors[12];
+  uint16_t       *dst = &gb->frame[ly * gb->frame_stride];
+  int             i;
+  
+  if(cgb_mode) {
+    const uint16_t *lut = gb->render_lut;
+    
+    for(i = 0; i < 160; ++i)
+      dst[i] = lut[src[i]];
+    
+    if(gb->line_hook) gb->line_hook(gb, ly, dst);
+    return;
+  }
+  
+  for(i = 0; i < 4; ++i) {
+    colors[i]     = gb_get_color(i, r->bgp);
+    colors[4 + i] = gb_get_color(i, r->obp0);
+    colors[8 + i] = gb_get_color(i, r->obp1);
+  }
+  
+  for(i = 0; i < 160; ++i)
+    dst[i] = colors[src[i]];
+  
+  if(gb->line_hook) gb->line_hook(gb, ly, dst);
+}
+
+
+/* Renders line ly for one LCDC configuration. Every configuration flag is a
+ * constant in the variants generated below, so none of them is tested inside
+ * the drawing loops. In CGB mode the background is always drawn and bg is the
+ * master priority switch instead. */
+static inline __attribute__((always_inline))
+void gb_render_variant(gb_t *gb, const gb_line_regs_t *r, int ly, const int cgb_mode,
+                       const int bg, const int unsigned_data, const int window,
+                       const int sprites, const int tall) {
+  uint16_t bg_map, win_map;
+  int      split = 160;
+  
+  if(bg || cgb_mode) {
+    bg_map  = TESTBIT(r->lcdc, 3) ? 0x9c00 : 0x9800;
+    win_map = TESTBIT(r->lcdc, 6) ? 0x9c00 : 0x9800;
+    if(window) split = gb_window_split(r, ly);
+    
+    /* Background span. */
+    if(split > 0) {
+      if(cgb_mode) gb_render_span_cgb(gb, unsigned_data, 0, split, bg_map, r->scx, r->scy + ly);
+      else         gb_render_span    (gb, unsigned_data, 0, split, bg_map, r->scx, r->scy + ly);
+    }
+    
+    /* Window span. */
+    if(split < 160) {
+      if(cgb_mode) gb_render_span_cgb(gb, unsigned_data, split, 160, win_map,
+                                      split - (r->wx - 7), r->window_line);
+      else         gb_render_span    (gb, unsigned_data, split, 160, win_map,
+                                      split - (r->wx - 7), r->window_line);
+    }
+  }
+  else {
+    memset(gb->line_buffer, 0, sizeof gb->line_buffer);
+  }
+  
+  if(sprites) gb_render_sprites(gb, tall, ly, cgb_mode, bg);
+  
+  gb_blit_line(gb, r, ly, cgb_mode);
+}
+
+/* Generates one renderer per combination of CGB mode and LCDC bits 0
+ * (background), 4 (tile data), 5 (window), 1 (sprites) and 2 (8x16
+ * sprites). */
+#define RENDERER(cgb, bg, data, win, obj, tall)                        \
+  static void gb_render_##cgb##bg##data##win##obj##tall(                \
+    gb_t *gb, const gb_line_regs_t *r, int ly) {                        \
+    gb_render_variant(gb, r, ly, cgb, bg, data, win, obj, tall);        \
+  }
+#define RENDERERS_OBJ(cgb, bg, data, win) \
+  RENDERER(cgb, bg, data, win, 0, 0)      \
+  RENDERER(cgb, bg, data, win, 0, 1)      \
+  RENDERER(cgb, bg, data, win, 1, 0)      \
+  RENDERER(cgb, bg, data, win, 1, 1)
+#define RENDERERS_WIN(cgb, bg, data) \
+  RENDERERS_OBJ(cgb, bg, data, 0)    \
+  RENDERERS_OBJ(cgb, bg, data, 1)
+#define RENDERERS_DATA(cgb, bg) \
+  RENDERERS_WIN(cgb, bg, 0)     \
+  RENDERERS_WIN(cgb, bg, 1)
+#define RENDERERS_BG(cgb) \
+  RENDERERS_DATA(cgb, 0)  \
+  RENDERERS_DATA(cgb, 1)
+
+RENDERERS_BG(0)
+RENDERERS_BG(1)
+
+#define ENTRY(cgb, bg, data, win, obj, tall) gb_render_##cgb##bg##data##win##obj##tall,
+#define ENTRIES_OBJ(cgb, bg, data, win) \
+  ENTRY(cgb, bg, data, win, 0, 0)       \
+  ENTRY(cgb, bg, data, win, 0, 1)       \
+  ENTRY(cgb, bg, data, win, 1, 0)       \
+  ENTRY(cgb, bg, data, win, 1, 1)
+#define ENTRIES_WIN(cgb, bg, data) \
+  ENTRIES_OBJ(cgb, bg, data, 0)    \
+  ENTRIES_OBJ(cgb, bg, data, 1)
+#define ENTRIES_DATA(cgb, bg) \
+  ENTRIES_WIN(cgb, bg, 0)     \
+  ENTRIES_WIN(cgb, bg, 1)
+#define ENTRIES_BG(cgb)   \
+  ENTRIES_DATA(cgb, 0)    \
+  ENTRIES_DATA(cgb, 1)
+
+static const gb_renderer_t renderers[64] = {
+  ENTRIES_BG(0)
+  ENTRIES_BG(1)
+};
+
+/* Returns the renderer for an LCDC value. */
+static gb_renderer_t gb_renderer(gb_t *gb, uint8_t value) {
+  return renderers[(gb->cgb.enabled << 5) |
+                   (BITVAL(value, 0) << 4) | (BITVAL(value, 4) << 3) |
+                   (BITVAL(value, 5) << 2) | (BITVAL(value, 1) << 1) |
+                   (BITVAL(value, 2) << 0)];
+}
+
+/* Picks the renderer for a new LCDC value. */
+void gb_lcdc_write(gb_t *gb, uint8_t value) {
+  gb->lcdc_renderer = gb_renderer(gb, value);
+  bgcache_lcdc(gb, value);
+}
+
 static uint16_t gb_get_color(uint8_t color, uint8_t palette) {
-  switch(color) {
+  switch((palette >> (color * 2)) & 0x3) {
     case 0: return RGB15(31, 31, 31);
     case 1: return RGB15(25, 25, 25);
     case 2: return RGB15(15, 15, 15);
@@ -295,20 +656,326 @@ static uint16_t gb_get_color(uint8_t color, uint8_t palette) {
   }
 }
 
-static void gb_draw_scanline() {
-  /* Render tiles. */
-  if(TESTBIT(LCDC, 0)) {
-    printf("rendering tiles..\n");
-    gb_render_tiles();
+/* Renders lines [first, last) of a frame log, reading from vram, vram1 and
+ * oam, which hold copies of both VRAM banks and 0xfe00-0xfe9f, and the CGB
+ * palette LUT. cached says whether they are the live copies the background
+ * cache follows. */
+static void gb_render_lines(gb_t *gb, const gb_line_t *log, int first, int last,
+                            const uint8_t *vram, const uint8_t *vram1,
+                            const uint8_t *oam, const uint16_t *lut, int cached) {
+  int ly;
+  
+  gb->render_vram   = vram;
+  gb->render_vram1  = vram1;
+  gb->render_oam    = oam;
+  gb->render_lut    = lut;
+  gb->render_cached = cached;
+  
+  for(ly = first; ly < last; ++ly) {
+    const gb_line_t *line = &log[ly];
+    
+    /* Skip lines that would come out exactly as they already are. */
+    if((gb->drawn[ly].epoch == line->epoch) &&
+       !memcmp(&gb->drawn[ly].regs, &line->regs, sizeof line->regs)) {
+      ++gb->stats.skipped_lines;
+      continue;
+    }
+    
+    gb->frame_drawn  = 1;
+    gb->render_epoch = line->epoch;
+    line->render(gb, &line->regs, ly);
+    gb->drawn[ly] = *line;
+  }
+}
+
+/* Accounts for a finished frame. Frames where every line was skipped didn't
+ * change the framebuffer, and neither did frames run without rendering. */
+static void gb_end_frame(gb_t *gb) {
+  ++gb->stats.frames;
+  if(!gb->frame_drawn) ++gb->stats.skipped_frames;
+  gb->frame_changed = gb->frame_drawn;
+  gb->frame_drawn   = 0;
+}
+
+#ifdef ORCHARD_THREADS
+static void *gb_worker(void *arg) {
+  gb_t *gb = arg;
+  
+  pthread_mutex_lock(&gb->worker_lock);
+  
+  for(;;) {
+    while(!gb->worker_busy && !gb->worker_quit)
+      pthread_cond_wait(&gb->worker_cond, &gb->worker_lock);
+    if(gb->worker_quit)
+      break;
+    pthread_mutex_unlock(&gb->worker_lock);
+    
+    gb_render_lines(gb, gb->job.lines, gb->job.first, 144, gb->job.vram,
+                    gb->job.vram1, gb->job.oam, gb->job.lut, 0);
+    gb_end_frame(gb);
+    
+    pthread_mutex_lock(&gb->worker_lock);
+    gb->worker_busy = 0;
+    pthread_cond_broadcast(&gb->worker_cond);
   }
-  /* Render sprites. */
-  /*if(TESTBIT(LCDC, 1)) gb_render_sprites();*/
+  
+  pthread_mutex_unlock(&gb->worker_lock);
+  return NULL;
+}
+
+/* Waits for the worker to finish the frame it was handed, if any. */
+static void gb_worker_wait(gb_t *gb) {
+  if(!gb->worker_started)
+    return;
+  
+  pthread_mutex_lock(&gb->worker_lock);
+  while(gb->worker_busy)
+    pthread_cond_wait(&gb->worker_cond, &gb->worker_lock);
+  pthread_mutex_unlock(&gb->worker_lock);
+}
+
+/* Hands the rest of the current frame to the worker. */
+static void gb_worker_start(gb_t *gb) {
+  gb_worker_wait(gb);
+  
+  if(!gb->worker_started) {
+    pthread_mutex_init(&gb->worker_lock, NULL);
+    pthread_cond_init(&gb->worker_cond, NULL);
+    pthread_create(&gb->worker, NULL, gb_worker, gb);
+    gb->worker_started = 1;
+  }
+  
+  memcpy(gb->job.lines, gb->line_log, sizeof gb->line_log);
+  memcpy(gb->job.vram, &MEM(0x8000), sizeof gb->job.vram);
+  memcpy(gb->job.oam,  &MEM(0xfe00), sizeof gb->job.oam);
+  if(gb->cgb.enabled) {
+    memcpy(gb->job.vram1, gb->cgb.vram1, sizeof gb->job.vram1);
+    memcpy(gb->job.lut,   gb->cgb.lut,   sizeof gb->job.lut);
+  }
+  gb->job.first = gb->log_first;
+  
+  pthread_mutex_lock(&gb->worker_lock);
+  gb->worker_busy = 1;
+  pthread_cond_broadcast(&gb->worker_cond);
+  pthread_mutex_unlock(&gb->worker_lock);
+}
+
+/* Ends the worker once it has finished its frame. */
+static void gb_worker_stop(gb_t *gb) {
+  if(!gb->worker_started)
+    return;
+  
+  pthread_mutex_lock(&gb->worker_lock);
+  while(gb->worker_busy)
+    pthread_cond_wait(&gb->worker_cond, &gb->worker_lock);
+  gb->worker_quit = 1;
+  pthread_cond_broadcast(&gb->worker_cond);
+  pthread_mutex_unlock(&gb->worker_lock);
+  pthread_join(gb->worker, NULL);
+  
+  pthread_mutex_destroy(&gb->worker_lock);
+  pthread_cond_destroy(&gb->worker_cond);
+  gb->worker_started = 0;
+  gb->worker_quit    = 0;
+}
+#else
+#define gb_worker_wait(gb)
+#define gb_worker_stop(gb)
+#endif
+
+/* Ends the instance's worker threads and removes its cartridge, after
+ * which the instance can be freed, or loaded and started again. */
+void gb_release(gb_t *gb) {
+  gb_worker_stop(gb);
+  apu_set_threaded(gb, 0);
+  cart_release(gb);
+}
+
+/* Picks the LCD up after a savestate replaced memory and the line log.
+ * Logged lines get their renderers back from their LCDC, and since the
+ * framebuffer no longer shows anything the state knows about, every line is
+ * drawn again and the caches start over. */
+void gb_lcd_resume(gb_t *gb) {
+  int enabled = gb->bgcache.enabled;
+  int ly;
+  
+  gb_worker_wait(gb);
+  for(ly = 0; ly < 144; ++ly)
+    gb->line_log[ly].render = gb_renderer(gb, gb->line_log[ly].regs.lcdc);
+  
+  bgcache_reset(gb);
+  bgcache_enable(gb, enabled);
+  gb->obj_cache.oam = NULL;
+  gb_lcdc_write(gb, LCDC);
+  
+  memset(gb->drawn, 0, sizeof gb->drawn);
+  gb->have_frame_log = 0;
+  gb->frame_changed  = 1;
+}
+
+/* Renders every captured line that is still pending. Called before VRAM or
+ * OAM change under lines that were captured against the old contents. */
+void gb_lcd_flush(gb_t *gb) {
+  gb_worker_wait(gb);
+  gb_render_lines(gb, gb->line_log, gb->log_first, gb->log_end, &MEM(0x8000),
+                  gb->cgb.vram1, &MEM(0xfe00), gb->cgb.lut, 1);
+  gb->log_first   = gb->log_end;
+  gb->lcd_pending = 0;
+}
+
+/* Finishes the frame at VBlank, rendering whatever is still pending. Without
+ * rendering, the log is kept so the frame can still be drawn on request. A
+ * queued render mode takes over for the frame that starts here. */
+static void gb_lcd_frame(gb_t *gb) {
+  if(gb->render_mode == GB_RENDER_NONE) {
+    memcpy(gb->frame_log, gb->line_log, sizeof gb->frame_log);
+    gb->have_frame_log = 1;
+    gb_end_frame(gb);
+  }
+  
+#ifdef ORCHARD_THREADS
+  else if(gb->render_mode == GB_RENDER_THREADED) {
+    gb_worker_start(gb);
+  }
+#endif
+  
+  else {
+    gb_lcd_flush(gb);
+    gb_end_frame(gb);
+  }
+  
+  gb->log_first   = 0;
+  gb->log_end     = 0;
+  gb->lcd_pending = 0;
+  
+  if(gb->render_next != gb->render_mode)
+    gb_set_render_mode(gb, gb->render_next);
+}
+
+/* Selects when captured lines are rendered: as they are captured, in one
+ * batch at VBlank, at VBlank on a worker thread, or not at all. The switch
+ * is immediate, and cancels a queued one. Lines captured without rendering
+ * weren't flushed before VRAM and OAM changed under them, so switching to a
+ * rendering mode mid-frame drops them; only the lines after the switch are
+ * drawn. */
+void gb_set_render_mode(gb_t *gb, gb_render_mode_t mode) {
+#ifndef ORCHARD_THREADS
+  if(mode == GB_RENDER_THREADED) mode = GB_RENDER_DEFERRED;
+#endif
+  
+  gb->render_next = mode;
+  if(mode == gb->render_mode)
+    return;
+  
+  if(gb->lcd_pending) gb_lcd_flush(gb);
+  gb_worker_wait(gb);
+  if(gb->render_mode == GB_RENDER_NONE) gb->log_first = gb->log_end;
+  gb->render_mode    = mode;
+  gb->have_frame_log = 0;
+}
+
+/* Switches render mode at the next VBlank instead, so every frame is
+ * captured whole in one mode. gb_run() stops a few dots short of a frame,
+ * so its calls don't line up with VBlank; a frontend choosing a mode per
+ * call queues it, and the choice applies to the frame the next call
+ * shows. */
+void gb_queue_render_mode(gb_t *gb, gb_render_mode_t mode) {
+#ifndef ORCHARD_THREADS
+  if(mode == GB_RENDER_THREADED) mode = GB_RENDER_DEFERRED;
+#endif
+  
+  gb->render_next = mode;
+}
+
+/* Installs a function called with each line's 160 RGB15 pixels as soon as
+ * the line is rendered, on whichever thread renders it. */
+void gb_set_line_hook(gb_t *gb, gb_line_hook_t hook) {
+  gb_worker_wait(gb);
+  gb->line_hook = hook;
+}
+
+/* Has lines drawn to pixels, 160 RGB15 pixels per line, stride pixels
+ * apart, instead of the DS screen. The new pixels hold none of the lines
+ * drawn so far, so every line is drawn again. */
+void gb_set_framebuffer(gb_t *gb, uint16_t *pixels, int stride) {
+  gb_worker_wait(gb);
+  gb->frame        = pixels;
+  gb->frame_stride = stride;
+  memset(gb->drawn, 0, sizeof gb->drawn);
+}
+
+/* Draws the last completed frame from its line log when running without
+ * rendering. VRAM and OAM are read as they are now, so the result is exact
+ * unless they changed after the frame was captured. Returns 0 if there is no
+ * frame to draw. */
+int gb_render_frame(gb_t *gb) {
+  if(!gb->have_frame_log)
+    return 0;
+  
+  gb_render_lines(gb, gb->frame_log, 0, 144, &MEM(0x8000), gb->cgb.vram1,
+                  &MEM(0xfe00), gb->cgb.lut, 1);
+  
+  /* The frame was counted as skipped when it ran; drawn now, it wasn't.
+   * have_frame_log goes to 2 so drawing it again doesn't count twice. */
+  if(gb->frame_drawn && (gb->have_frame_log == 1)) {
+    --gb->stats.skipped_frames;
+    gb->have_frame_log = 2;
+  }
+  gb->frame_changed = gb->frame_drawn;
+  gb->frame_drawn   = 0;
+  return 1;
+}
+
+/* Returns 1 if the framebuffer changed during the last completed frame. Frames
+ * that didn't change don't need to be presented. */
+int gb_frame_changed(gb_t *gb) {
+  gb_worker_wait(gb);
+  return gb->frame_changed;
+}
+
+/* Captures the registers of line LY. The line is rendered right away, or left
+ * pending until VBlank or the next VRAM/OAM change. */
+static void gb_draw_scanline(gb_t *gb) {
+  gb_line_t *line = &gb->line_log[LY];
+  
+  /* Lines are normally captured in order; anything else ends the batch. */
+  if(LY != gb->log_end) {
+    if(gb->lcd_pending) gb_lcd_flush(gb);
+    gb->log_first = LY;
+  }
+  
+  line->regs.lcdc        = LCDC;
+  line->regs.scy         = SCY;
+  line->regs.scx         = SCX;
+  line->regs.wy          = WY;
+  line->regs.wx          = WX;
+  line->regs.bgp         = BGP;
+  line->regs.obp0        = OBP0;
+  line->regs.obp1        = OBP1;
+  line->regs.window_line = gb->window_line;
+  
+  if(gb->lcd_dirty) {
+    ++gb->lcd_epoch;
+    gb->lcd_dirty = 0;
+  }
+  line->epoch  = gb->lcd_epoch;
+  line->render = gb->lcdc_renderer;
+  
+  /* The window line counter only advances on lines that show the window. */
+  if((TESTBIT(LCDC, 0) || gb->cgb.enabled) && (gb_window_split(&line->regs, LY) < 160))
+    ++gb->window_line;
+  
+  gb->log_end = LY + 1;
+  
+  if(gb->render_mode == GB_RENDER_INLINE)    gb_lcd_flush(gb);
+  else if(gb->render_mode != GB_RENDER_NONE) gb->lcd_pending = 1;
 }
 
-static void gb_set_lcd() {
+static inline __attribute__((always_inline)) void gb_set_lcd(gb_t *gb) {
   int     cur_mode, next_mode, intr;
   
   if(!TESTBIT(LCDC, 7)) {
+    if(gb->lcd_pending) gb_lcd_flush(gb);
     LY    = 0;
     STAT &= 252;
     STAT |= BIT(0);
@@ -329,7 +996,7 @@ static void gb_set_lcd() {
   
   else {
     /* Mode 2 (Searching sprite attributes). */
-    if(scanline >= MODE2_BOUND) {
+    if(gb->scanline >= MODE2_BOUND) {
       next_mode = 2;
       STAT |= BIT(1);
       STAT &= ~BIT(0);
@@ -337,7 +1004,7 @@ static void gb_set_lcd() {
     }
     
     /* Mode 3 (Transferring data). */
-    else if(scanline >= MODE3_BOUND) {
+    else if(gb->scanline >= MODE3_BOUND) {
       next_mode = 3;
       STAT |= BIT(1) | BIT(0);
     }
@@ -352,14 +1019,14 @@ static void gb_set_lcd() {
   
   /* Entered a new mode. Request interrupt. */
   if(intr && (cur_mode != next_mode)) {
-    gb_intr(intr_lcd);
+    gb_intr(gb, intr_lcd);
   }
   
   /* Check against comparison register. */
   if(LY == LYC) {
     STAT |= BIT(2);
     if(TESTBIT(STAT, 6))
-      gb_intr(intr_lcd);
+      gb_intr(gb, intr_lcd);
   }
   else {
     STAT &= ~BIT(2);
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+
+#include "gb.h"
+#include "joypad.h"
+#include "movie.h"
+#include "z80.h"
+
+#define pad (gb->pad)
+
+/* Samples the source. Bit 4 low selects the d-pad and bit 5 low the other
+ * buttons; a held button pulls its line low. Any line going low raises the
+ * joypad interrupt. */
+static uint8_t joypad_sample(gb_t *gb) {
+  uint8_t buttons = pad.source ? pad.source(gb) : pad.snapshot;
+  uint8_t lines   = 0x0f;
+  
+  if(pad.movie) buttons = movie_buttons(pad.movie, buttons);
+  
+  if(!(pad.select & 0x10)) lines &= ~(buttons & 0x0f);
+  if(!(pad.select & 0x20)) lines &= ~(buttons >> 4);
+  
+  if(pad.lines & ~lines) IF |= 0x10;
+  pad.lines = lines;
+  
+  return P1 = 0xc0 | pad.select | lines;
+}
+
+/* Starts with nothing selected. The source and any movie are kept. */
+void joypad_reset(gb_t *gb) {
+  pad.select = 0x30;
+  pad.lines  = 0x0f;
+  P1         = 0xff;
+}
+
+/* Sets the state the default source returns. Any thread may call it. */
+void joypad_set(gb_t *gb, uint8_t buttons) {
+  pad.snapshot = buttons;
+}
+
+/* Installs a source, or restores the snapshot with NULL. */
+void joypad_set_source(gb_t *gb, joypad_source_t source) {
+  pad.source = source;
+}
+
+/* Handles a read of 0xff00. */
+uint8_t joypad_read(gb_t *gb) {
+  return joypad_sample(gb);
+}
+
+/* Handles a write to 0xff00; only the select lines can be written. */
+void joypad_write(gb_t *gb, uint8_t value) {
+  pad.select = value & 0x30;
+  joypad_sample(gb);
+}
+
+/* Looks for presses while the game isn't reading P1, so the interrupt still
+ * comes. Called once a frame. */
+void joypad_poll(gb_t *gb) {
+  joypad_sample(gb);
+  if(pad.movie) ++pad.movie->frames;
+}
@@ -25,50 +25,31 @@
 
 #include <nds.h>
 #include <stdio.h>
+#include <string.h>
 
+#include "cart.h"
 #include "gb.h"
 #include "loader.h"
+#include "rom.h"
 
 #define die(msg) do { \
   iprintf("error: %s\n", msg); \
   exit(EXIT_FAILURE); \
   } while(0)
 
-void load_file(const char *name) {
-  FILE         *f = fopen(name, "rb");
-  unsigned int  i;
+/* Inserts a ROM file as the instance's cartridge. The image is shared with
+ * every other instance running the same file. */
+void load_file(gb_t *gb, const char *name) {
+  rom_t *rom = rom_open(name);
   
-  if(!f)
-    die("failed to open file");
-
-  /* Read in first ROM bank. */
-  if(fread(z80_memory, 1, 0x8000, f) != 0x8000)
-    die("unexpected end of file loading initial bank");
-  
-  /* Allocate space for the rest of the ROM banks. */
-  bank_count = z80_memory[0x148];
-  banks      = malloc(sizeof *banks * (bank_count + 1));
-  if(!banks)
-    die("failed to allocate enough memory banks.");
-  
-  iprintf("allocated for %u extra banks\n", bank_count);
-  
-  /* Read in all of the banks. */
-  fseek(f, 0x3fff, SEEK_SET);
-  for(i = 0; i < bank_count + 1; ++i) {
-    size_t sz = fread(banks[i], 1, sizeof banks[i], f);
-    if(sz != sizeof banks[i]) {
-      iprintf("size of read chunk: %u\n", sz);
-      iprintf("position in file: %lu\n", ftell(f));
-      die("unexpected end of file loading auxiliary banks");
-    }
-    iprintf("loaded bank.\n");
-  }
-  
-  iprintf("loaded %u banks.\n", bank_count + 2);
+  if(!rom)
+    die("failed to read the ROM");
+  if(!cart_load(gb, rom))
+    die("failed to allocate cartridge RAM");
   
-  fclose(f);
+  iprintf("loaded %d banks.\n", rom->banks);
+  rom_unref(rom);
 }
 
-void load_adapter(void) {
+void load_adapter(gb_t *gb) {
 }
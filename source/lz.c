@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+#define MIN_MATCH  4
+#define MAX_OFFSET 0xffff
+
+/* Positions are kept by their low 16 bits, which is all an offset can
+ * reach, so the table stays small enough for the DS stack. */
+#define HASH_BITS 12
+
+/* Bytes at the end that are always left as literals, so matching can read
+ * 4 bytes anywhere before them. */
+#define TAIL 8
+
+static inline uint32_t lz_read32(const uint8_t *p) {
+  uint32_t v;
+  
+  memcpy(&v, p, sizeof v);
+  return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v) {
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/* Writes what doesn't fit in a token's 4 bits as bytes of 255 and the
+ * rest. */
+static uint8_t *lz_put_length(uint8_t *op, size_t n) {
+  for(; n >= 255; n -= 255) *op++ = 255;
+  *op++ = n;
+  return op;
+}
+
+/* Writes a sequence: the literals from lit, then a match of length len at
+ * offset back, or none when len is 0. */
+static uint8_t *lz_sequence(uint8_t *op, const uint8_t *lit, size_t count,
+                            size_t offset, size_t len) {
+  size_t ml = len ? len - MIN_MATCH : 0;
+  
+  *op++ = ((count < 15) ? count : 15) << 4 | ((ml < 15) ? ml : 15);
+  if(count >= 15) op = lz_put_length(op, count - 15);
+  memcpy(op, lit, count);
+  op += count;
+  
+  if(len) {
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    if(ml >= 15) op = lz_put_length(op, ml - 15);
+  }
+  
+  return op;
+}
+
+/* The most lz_compress() can write for size bytes of input. */
+size_t lz_bound(size_t size) {
+  return size + size / 255 + 16;
+}
+
+/* Compresses size bytes into out, which must hold lz_bound(size) bytes.
+ * Returns the compressed size. */
+size_t lz_compress(const uint8_t *in, size_t size, uint8_t *out) {
+  uint16_t       table[1 << HASH_BITS];
+  const uint8_t *ip     = in;
+  const uint8_t *anchor = in;
+  const uint8_t *end    = in + size;
+  const uint8_t *limit  = (size > TAIL) ? end - TAIL : in;
+  uint8_t       *op     = out;
+  
+  memset(table, 0, sizeof table);
+  
+  while(ip < limit) {
+    uint32_t       v     = lz_read32(ip);
+    uint32_t       h     = lz_hash(v);
+    size_t         pos   = ip - in;
+    size_t         cand  = (pos & ~(size_t)0xffff) | table[h];
+    const uint8_t *match, *q;
+    
+    table[h] = pos;
+    if(cand >= pos) cand -= 0x10000;
+    
+    /* cand wraps past pos when there is nothing that far back. The longer
+     * nothing matches, the further ahead the next try, so data that doesn't
+     * compress goes by quickly. */
+    if((cand >= pos) || (pos - cand > MAX_OFFSET) || (lz_read32(in + cand) != v)) {
+      ip += 1 + ((ip - anchor) >> 6);
+      continue;
+    }
+    
+    match = in + cand + MIN_MATCH;
+    for(q = ip + MIN_MATCH; (q < limit) && (*q == *match); ++q, ++match) { }
+    
+    op     = lz_sequence(op, anchor, ip - anchor, pos - cand, q - ip);
+    ip     = q;
+    anchor = ip;
+  }
+  
+  op = lz_sequence(op, anchor, end - anchor, 0, 0);
+  return op - out;
+}
+
+/* Reads a length continued past a token's 4 bits. Returns 0 if the input
+ * ends first. */
+static int lz_get_length(const uint8_t **ip, const uint8_t *end, size_t *n) {
+  uint8_t b;
+  
+  do {
+    if(*ip >= end)
+      return 0;
+    b   = *(*ip)++;
+    *n += b;
+  } while(b == 255);
+  
+  return 1;
+}
+
+/* Decompresses size bytes of input into out, which holds max bytes.
+ * Returns the decompressed size, or 0 if the input is malformed or doesn't
+ * fit. */
+size_t lz_decompress(const uint8_t *in, size_t size, uint8_t *out, size_t max) {
+  const uint8_t *ip  = in;
+  const uint8_t *end = in + size;
+  uint8_t       *op  = out;
+  uint8_t       *top = out + max;
+  
+  while(ip < end) {
+    uint8_t        token = *ip++;
+    size_t         count = token >> 4;
+    size_t         len   = token & 15;
+    size_t         offset;
+    
+    if((count == 15) && !lz_get_length(&ip, end, &count))
+      return 0;
+    if(((size_t)(end - ip) < count) || ((size_t)(top - op) < count))
+      return 0;
+    memcpy(op, ip, count);
+    ip += count;
+    op += count;
+    
+    /* Only the last sequence ends after its literals. */
+    if(ip == end)
+      break;
+    
+    if(end - ip < 2)
+      return 0;
+    offset = ip[0] | (ip[1] << 8);
+    ip    += 2;
+    
+    if((len == 15) && !lz_get_length(&ip, end, &len))
+      return 0;
+    len += MIN_MATCH;
+    
+    if(!offset || (offset > (size_t)(op - out)) || ((size_t)(top - op) < len))
+      return 0;
+    
+    /* An overlapping match repeats its first offset bytes. Each copy
+     * doubles how much of the pattern is written, and can take twice as
+     * much next time. */
+    while(len) {
+      size_t n = (offset < len) ? offset : len;
+      
+      memcpy(op, op - offset, n);
+      op     += n;
+      len    -= n;
+      offset += n;
+    }
+  }
+  
+  return op - out;
+}
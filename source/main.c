@@ -27,12 +27,25 @@
 #include <nds.h>
 #include <stdio.h>
 
+#include "apu.h"
+#include "frameskip.h"
 #include "gb.h"
+#include "joypad.h"
 #include "loader.h"
 #include "z80.h"
 
 int sstep = 0;
 
+static gb_t machine;
+
+/* Reads the buttons straight from the hardware whenever the game reads P1.
+ * KEYINPUT holds A, B, Select, Start, then the d-pad, with 0 for held. */
+static uint8_t ds_keys(gb_t *gb) {
+  uint16_t keys = ~REG_KEYINPUT;
+  
+  return ((keys >> 4) & 0x0f) | ((keys & 0x0f) << 4);
+}
+
 int main(void) {
   /* Initialize framebuffer mode. */
   videoSetMode(MODE_FB0);
@@ -49,24 +62,47 @@ int main(void) {
         VRAM_A[y*SCREEN_WIDTH + x] = RGB15(31, 31, 31);
   }
   
-  /* Initialize Gameboy. */
-  gb_init();
-  
   /* Initialize FAT. */
   fatInitDefault();
-  load_file("test.gb");
+  load_file(&machine, "test.gb");
+  
+  /* Initialize Gameboy, in CGB mode if the cartridge asks for it. Lines are
+   * rendered in one batch at VBlank. */
+  gb_init(&machine);
+  gb_set_render_mode(&machine, GB_RENDER_DEFERRED);
+  joypad_set_source(&machine, ds_keys);
+  
+  /* Nothing plays sound yet, so skip synthesizing it. */
+  apu_enable(&machine, 0);
   
   /* Print version information to console. */
   iprintf("Orchard v0.1\n");
   iprintf("by Forest Belton (c) 2010\n");
   
+  /* Frame times are measured with timers 2 and 3 at the bus clock. Up to 4
+   * frames in a row may go unrendered when emulation falls behind. Whether
+   * a frame is rendered is queued, so it holds from VBlank to VBlank. */
+  cpuStartTiming(2);
+  frameskip_init(cpuGetTiming, BUS_CLOCK, 4);
+  
   /* Execute loop. */
   while(1) {
-    gb_run();
+    gb_queue_render_mode(&machine, frameskip_begin() ? GB_RENDER_DEFERRED : GB_RENDER_NONE);
+    gb_run(&machine);
+    frameskip_end();
     
     scanKeys();
     if(keysDown() & KEY_L) sstep ^= 1;
-    
+
+    /* Report how many frames didn't need redrawing, and frame skipping. */
+    if(keysDown() & KEY_R) {
+      iprintf("skipped %lu/%lu frames\n", (unsigned long)machine.stats.skipped_frames,
+        (unsigned long)machine.stats.frames);
+      iprintf("frameskip %d, %lu/%lu frames\n", frameskip_level(),
+        (unsigned long)frameskip_stats.skipped_frames,
+        (unsigned long)frameskip_stats.frames);
+    }
+
     swiWaitForVBlank();
   }
   return 0;
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gb.h"
+#include "hash.h"
+#include "movie.h"
+#include "rom.h"
+#include "state.h"
+
+/* Hashes the machine's raw state, or returns 0 without the memory to. How
+ * far the renderer has got through the lines logged depends on the render
+ * mode rather than the game, so that is left out, and a movie recorded
+ * with pixels plays back the same without. */
+static uint32_t movie_state_hash(gb_t *gb) {
+  size_t    size    = state_size(gb);
+  uint8_t  *buf     = malloc(size);
+  uint8_t   pending = gb->lcd_pending;
+  int       first   = gb->log_first;
+  uint32_t  h;
+  
+  if(!buf)
+    return 0;
+  
+  gb->lcd_pending = 0;
+  gb->log_first   = 0;
+  h = hash_fnv(HASH_INIT, buf, state_save(gb, buf, size, 0));
+  gb->lcd_pending = pending;
+  gb->log_first   = first;
+  
+  free(buf);
+  return h;
+}
+
+static void movie_put_count(FILE *out, uint64_t n) {
+  while(n >= 0x80) {
+    putc((int)(n & 0x7f) | 0x80, out);
+    n >>= 7;
+  }
+  putc((int)n, out);
+}
+
+/* Reads the next change to play, unless the movie ends first. */
+static void movie_next(movie_t *mv) {
+  const uint8_t *ip    = mv->in;
+  uint64_t       n     = 0;
+  int            shift = 0;
+  
+  mv->pending = 0;
+  do {
+    if((ip == mv->in_end) || (shift > 56))
+      return;
+    n     |= (uint64_t)(*ip & 0x7f) << shift;
+    shift += 7;
+  } while(*ip++ & 0x80);
+  
+  if(ip == mv->in_end)
+    return;
+  mv->next    = *ip++;
+  mv->at     += n;
+  mv->pending = 1;
+  mv->in      = ip;
+}
+
+static void movie_header(movie_t *mv, gb_t *gb) {
+  memset(mv, 0, sizeof *mv);
+  mv->header.magic   = MOVIE_MAGIC;
+  mv->header.version = MOVIE_VERSION;
+  if(gb->cart.rom) {
+    mv->header.rom      = hash_fnv(HASH_INIT, gb->cart.rom->data, gb->cart.rom->size);
+    mv->header.rom_size = gb->cart.rom->size;
+  }
+}
+
+/* Starts recording to out from the state the machine is in now. */
+int movie_record(movie_t *mv, gb_t *gb, FILE *out) {
+  size_t   size = state_size(gb);
+  uint8_t *buf  = malloc(size);
+  int      ok;
+  
+  if(!buf)
+    return 0;
+  
+  movie_header(mv, gb);
+  mv->header.state = state_save(gb, buf, size, STATE_COMPRESS);
+  ok = (fwrite(&mv->header, sizeof mv->header, 1, out) == 1) &&
+       (fwrite(buf, 1, mv->header.state, out) == mv->header.state);
+  free(buf);
+  if(!ok)
+    return 0;
+  
+  mv->out       = out;
+  gb->pad.movie = mv;
+  return 1;
+}
+
+/* Puts the machine in the movie's start state and plays it from data,
+ * which has to stay put until the movie stops. Fails, and leaves the
+ * machine as it was, for a movie of another game. */
+int movie_play(movie_t *mv, gb_t *gb, const void *data, size_t size) {
+  const uint8_t  *in = data;
+  movie_header_t  header;
+  
+  if(size < sizeof header)
+    return 0;
+  memcpy(&header, in, sizeof header);
+  
+  movie_header(mv, gb);
+  if((header.magic != MOVIE_MAGIC) || (header.version != MOVIE_VERSION) ||
+     (header.rom != mv->header.rom) || (header.rom_size != mv->header.rom_size) ||
+     (header.state > size - sizeof header) ||
+     !state_load(gb, in + sizeof header, header.state))
+    return 0;
+  
+  mv->header    = header;
+  mv->in        = in + sizeof header + header.state;
+  mv->in_end    = in + size;
+  movie_next(mv);
+  gb->pad.movie = mv;
+  return 1;
+}
+
+/* Called by the joypad with the buttons held at each sample: records them
+ * if they changed, or replaces them with the movie's. */
+uint8_t movie_buttons(movie_t *mv, uint8_t buttons) {
+  if(mv->out) {
+    if(buttons != mv->buttons) {
+      movie_put_count(mv->out, mv->samples - mv->at);
+      putc(buttons, mv->out);
+      mv->at      = mv->samples;
+      mv->buttons = buttons;
+      ++mv->header.changes;
+    }
+  }
+  else if(mv->pending && (mv->samples == mv->at)) {
+    mv->buttons = mv->next;
+    movie_next(mv);
+  }
+  
+  ++mv->samples;
+  return mv->buttons;
+}
+
+/* Stops recording or playing. A recording gets its frame count and end
+ * state written into its header, and returns whether everything was
+ * written; playing returns whether the machine ended in the state
+ * recorded, which a movie cut off can't say. */
+int movie_stop(movie_t *mv, gb_t *gb) {
+  uint32_t end = movie_state_hash(gb);
+  
+  gb->pad.movie = NULL;
+  if(!mv->out)
+    return mv->header.frames && (mv->frames == mv->header.frames) &&
+           (end == mv->header.end);
+  
+  mv->header.frames = mv->frames;
+  mv->header.end    = end;
+  if(fflush(mv->out) || fseek(mv->out, 0, SEEK_SET) ||
+     (fwrite(&mv->header, sizeof mv->header, 1, mv->out) != 1) ||
+     fseek(mv->out, 0, SEEK_END))
+    return 0;
+  
+  mv->out = NULL;
+  return 1;
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "ratectl.h"
+
+/* The fill is smoothed over about this many updates, since hosts take
+ * samples out in bursts. */
+#define SMOOTH_SHIFT 2
+
+/* Updates for the integral term alone to reach the full correction with the
+ * buffer one target away from where it should be. */
+#define INTEGRAL_FRAMES 120
+
+static struct {
+  int     rate;
+  int     target;
+  int     max_ppm;
+  int32_t smooth;    /* Fill, in 1 / (1 << SMOOTH_SHIFT) frames. */
+  int32_t integral;  /* In parts per billion. */
+} rc;
+
+ratectl_stats_t ratectl_stats;
+
+/* Sets up the controller for a buffer played at rate frames per second, to
+ * be kept target frames full, with corrections of up to max_ppm. */
+void ratectl_init(int rate, int target, int max_ppm) {
+  memset(&rc, 0, sizeof rc);
+  memset(&ratectl_stats, 0, sizeof ratectl_stats);
+  
+  rc.rate    = rate;
+  rc.target  = target;
+  rc.max_ppm = max_ppm;
+  rc.smooth  = target << SMOOTH_SHIFT;
+  
+  ratectl_stats.fill_min = 0x7fffffff;
+}
+
+static int32_t ratectl_clamp(int64_t v, int32_t limit) {
+  if(v >  limit) return  limit;
+  if(v < -limit) return -limit;
+  return v;
+}
+
+/* Called once a frame with the host buffer's fill, in frames. Returns how
+ * far to raise the ratio of input to output samples, in ppm: positive when
+ * the buffer is too full, so fewer samples are made, negative when it runs
+ * low. Half the range is proportional to the error; the integral term takes
+ * up steady drift, so the fill settles on the target instead of beside it. */
+int32_t ratectl_update(int fill) {
+  int32_t error;
+  int64_t p;
+  
+  rc.smooth += fill - (rc.smooth >> SMOOTH_SHIFT);
+  
+  /* How far off the target, as a fraction of it, in ppm. */
+  error = ratectl_clamp(((int64_t)(rc.smooth >> SMOOTH_SHIFT) - rc.target) * 1000000 / rc.target,
+                        1000000);
+  
+  p           = (int64_t)error * rc.max_ppm / 2000000;
+  rc.integral = ratectl_clamp(rc.integral + (int64_t)error * rc.max_ppm / 1000 / INTEGRAL_FRAMES,
+                              rc.max_ppm * 1000);
+  
+  ++ratectl_stats.updates;
+  ratectl_stats.fill        = fill;
+  ratectl_stats.fill_total += fill;
+  ratectl_stats.latency_us  = (uint64_t)fill * 1000000 / rc.rate;
+  ratectl_stats.adjust_ppm  = ratectl_clamp(p + rc.integral / 1000, rc.max_ppm);
+  if(fill < ratectl_stats.fill_min) ratectl_stats.fill_min = fill;
+  if(fill > ratectl_stats.fill_max) ratectl_stats.fill_max = fill;
+  if(ratectl_stats.latency_us > ratectl_stats.latency_max_us)
+    ratectl_stats.latency_max_us = ratectl_stats.latency_us;
+  
+  return ratectl_stats.adjust_ppm;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "resample.h"
+
+#define PHASE_BITS 9
+#define PI         3.14159265358979323846
+
+/* Fraction of the lower Nyquist frequency the filter passes. */
+#define CUTOFF 0.9
+
+/* Sine without libm: reduced to [-pi, pi], then a Taylor series. */
+static double resample_sin(double x) {
+  double term, sum;
+  int    i;
+  
+  while(x >  PI) x -= 2 * PI;
+  while(x < -PI) x += 2 * PI;
+  
+  term = sum = x;
+  for(i = 1; i < 12; ++i) {
+    term *= -x * x / ((2 * i) * (2 * i + 1));
+    sum  += term;
+  }
+  
+  return sum;
+}
+
+int32_t resample_dot_generic(const int16_t *x, const int16_t *k, int n) {
+  int32_t sum = 0;
+  int     i;
+  
+  for(i = 0; i < n; ++i)
+    sum += x[i] * k[i];
+  
+  return sum;
+}
+
+#ifdef __SSE2__
+int32_t resample_dot(const int16_t *x, const int16_t *k, int n) {
+  __m128i acc = _mm_setzero_si128();
+  int     i;
+  
+  for(i = 0; i < n; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i *)&x[i]);
+    __m128i b = _mm_loadu_si128((const __m128i *)&k[i]);
+    
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(a, b));
+  }
+  
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+  acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(acc);
+}
+#else
+int32_t resample_dot(const int16_t *x, const int16_t *k, int n) {
+  return resample_dot_generic(x, k, n);
+}
+#endif
+
+/* Builds a Blackman-windowed sinc for each phase. Phase p is centered p /
+ * RESAMPLE_PHASES of a sample past tap taps / 2 - 1, and sums exactly to
+ * 1 << 15 so silence and DC pass unchanged. Returns 0 if taps isn't a
+ * multiple of 8 from 8 to RESAMPLE_MAX_TAPS. */
+int resampler_init(resampler_t *r, int taps, int in_rate, int out_rate) {
+  double cutoff = CUTOFF * ((out_rate < in_rate) ? (double)out_rate / in_rate : 1);
+  int    p, i;
+  
+  if((taps < 8) || (taps > RESAMPLE_MAX_TAPS) || (taps & 7) ||
+     (in_rate <= 0) || (out_rate <= 0))
+    return 0;
+  
+  memset(r, 0, sizeof *r);
+  r->taps = taps;
+  r->step = ((uint64_t)in_rate << 32) / out_rate;
+  
+  for(p = 0; p < RESAMPLE_PHASES; ++p) {
+    double k[RESAMPLE_MAX_TAPS], total = 0;
+    int    sum = 0;
+    
+    for(i = 0; i < taps; ++i) {
+      double x = i - (taps / 2 - 1) - (double)p / RESAMPLE_PHASES;
+      double s = x ? resample_sin(PI * x * cutoff) / (PI * x) : cutoff;
+      double w = 0.42 + 0.5  * resample_sin(2 * PI * x / taps + PI / 2)
+                      + 0.08 * resample_sin(4 * PI * x / taps + PI / 2);
+      
+      k[i]   = s * w;
+      total += k[i];
+    }
+    
+    for(i = 0; i < taps; ++i) {
+      double v = k[i] / total * (1 << 15);
+      
+      r->coef[p][i] = (int16_t)(v < 0 ? v - 0.5 : v + 0.5);
+      sum          += r->coef[p][i];
+    }
+    r->coef[p][taps / 2 - 1 + (p >= RESAMPLE_PHASES / 2)] += (1 << 15) - sum;
+  }
+  
+  return 1;
+}
+
+/* Sets the number of input samples per output sample. Small changes while
+ * running are how output is kept in step with a host's audio clock; the
+ * filter stays the one built for the nominal rates. */
+void resampler_set_ratio(resampler_t *r, double ratio) {
+  r->step = (uint64_t)(ratio * 4294967296.0 + 0.5);
+}
+
+double resampler_ratio(const resampler_t *r) {
+  return r->step / 4294967296.0;
+}
+
+/* Buffers up to frames interleaved stereo samples, and returns how many fit. */
+int resampler_write(resampler_t *r, const int16_t *in, int frames) {
+  int i;
+  
+  if(frames > RESAMPLE_BUFFER - r->fill)
+    frames = RESAMPLE_BUFFER - r->fill;
+  
+  for(i = 0; i < frames; ++i) {
+    r->in[0][r->fill + i] = in[i * 2];
+    r->in[1][r->fill + i] = in[i * 2 + 1];
+  }
+  r->fill += frames;
+  
+  return frames;
+}
+
+static inline int16_t resample_clamp(int32_t sum) {
+  sum = (sum + (1 << 14)) >> 15;
+  if(sum >  32767) return  32767;
+  if(sum < -32768) return -32768;
+  return sum;
+}
+
+/* Produces up to frames interleaved stereo samples from the buffered input,
+ * and returns how many were produced. Input no later output needs is
+ * dropped. */
+int resampler_read(resampler_t *r, int16_t *out, int frames) {
+  int n = 0, used;
+  
+  while(n < frames) {
+    int            at = r->pos >> 32;
+    const int16_t *k  = r->coef[(uint32_t)r->pos >> (32 - PHASE_BITS)];
+    
+    if(at + r->taps > r->fill)
+      break;
+    
+    *out++  = resample_clamp(resample_dot(&r->in[0][at], k, r->taps));
+    *out++  = resample_clamp(resample_dot(&r->in[1][at], k, r->taps));
+    r->pos += r->step;
+    ++n;
+  }
+  
+  used = r->pos >> 32;
+  if(used > r->fill) used = r->fill;
+  if(used) {
+    memmove(r->in[0], r->in[0] + used, (r->fill - used) * sizeof r->in[0][0]);
+    memmove(r->in[1], r->in[1] + used, (r->fill - used) * sizeof r->in[1][0]);
+    r->fill -= used;
+    r->pos  -= (uint64_t)used << 32;
+  }
+  
+  return n;
+}
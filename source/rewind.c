@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gb.h"
+#include "lz.h"
+#include "rewind.h"
+#include "state.h"
+
+/* Deltas are found and applied a machine word at a time. */
+typedef unsigned long word_t;
+
+/* Words compared at once while looking for a change. */
+#define BLOCK 32
+
+#define WORDS(bytes) (((bytes) + sizeof(word_t) - 1) / sizeof(word_t))
+
+static uint8_t *rewind_put_count(uint8_t *op, size_t n) {
+  while(n >= 0x80) {
+    *op++ = n | 0x80;
+    n   >>= 7;
+  }
+  *op++ = n;
+  return op;
+}
+
+static const uint8_t *rewind_get_count(const uint8_t *ip, size_t *n) {
+  int shift = 0;
+  
+  *n = 0;
+  do {
+    *n    |= (size_t)(*ip & 0x7f) << shift;
+    shift += 7;
+  } while(*ip++ & 0x80);
+  
+  return ip;
+}
+
+/* Codes the XOR of two states as runs: a count of words that didn't change,
+ * a count that did, and the XOR of those. Nothing is written after the last
+ * change. Returns the size of the code. */
+static size_t rewind_delta(const word_t *cur, const word_t *prev, size_t words,
+                           uint8_t *out) {
+  uint8_t *op = out;
+  size_t   i  = 0;
+  
+  while(i < words) {
+    size_t start = i;
+    
+    /* Most of a state doesn't change, so unchanged words are skipped a
+     * block at a time first, with the library's memcmp(). */
+    while((i + BLOCK <= words) && !memcmp(&cur[i], &prev[i], BLOCK * sizeof(word_t)))
+      i += BLOCK;
+    while((i < words) && (cur[i] == prev[i])) ++i;
+    if(i == words)
+      break;
+    op    = rewind_put_count(op, i - start);
+    
+    start = i;
+    while((i < words) && (cur[i] != prev[i])) ++i;
+    op    = rewind_put_count(op, i - start);
+    
+    for(; start < i; ++start) {
+      word_t x = cur[start] ^ prev[start];
+      
+      memcpy(op, &x, sizeof x);
+      op += sizeof x;
+    }
+  }
+  
+  return op - out;
+}
+
+/* XORs a delta into a state, which takes it to the other frame. */
+static void rewind_apply(const uint8_t *ip, size_t size, word_t *state) {
+  const uint8_t *end = ip + size;
+  
+  while(ip < end) {
+    size_t skip, count;
+    
+    ip     = rewind_get_count(ip, &skip);
+    ip     = rewind_get_count(ip, &count);
+    state += skip;
+    
+    for(; count; --count) {
+      word_t x;
+      
+      memcpy(&x, ip, sizeof x);
+      *state++ ^= x;
+      ip       += sizeof x;
+    }
+  }
+}
+
+static rewind_entry_t *rewind_entry(rewind_t *rw, int i) {
+  return &rw->entries[(rw->first + i) % rw->entry_cap];
+}
+
+/* Drops the oldest keyframe and the deltas after it. */
+static void rewind_evict(rewind_t *rw) {
+  do {
+    rw->used  -= rewind_entry(rw, 0)->size;
+    rw->first  = (rw->first + 1) % rw->entry_cap;
+    --rw->count;
+    ++rw->evicted;
+  } while(rw->count && !rewind_entry(rw, 0)->key);
+  
+  --rw->keys;
+}
+
+/* Finds where size bytes fit after the newest entry, wrapping to the start
+ * of the ring if they don't fit before its end. Returns 0 if they don't fit
+ * without overwriting an entry. */
+static int rewind_fit(rewind_t *rw, size_t size, size_t *at) {
+  const rewind_entry_t *oldest, *newest;
+  size_t                lo, hi;
+  
+  if(!rw->count) {
+    *at = 0;
+    return size <= rw->ring_size;
+  }
+  
+  oldest = rewind_entry(rw, 0);
+  newest = rewind_entry(rw, rw->count - 1);
+  lo     = oldest->offset;
+  hi     = newest->offset + newest->size;
+  
+  /* Entries run from lo to hi, or from lo to the end and on from 0. */
+  if(newest->offset >= lo) {
+    if(rw->ring_size - hi >= size) *at = hi;
+    else if(lo >= size)            *at = 0;
+    else                           return 0;
+    return 1;
+  }
+  
+  *at = hi;
+  return lo - hi >= size;
+}
+
+/* Adds an entry for the size bytes coded, making room first. Deltas may
+ * only push out keyframes before their own. Returns 0 if there isn't room
+ * even so. */
+static int rewind_store(rewind_t *rw, size_t size, int key) {
+  rewind_entry_t *e;
+  size_t          at;
+  
+  while(!rewind_fit(rw, size, &at)) {
+    if(!rw->count || (!key && (rw->keys < 2)))
+      return 0;
+    rewind_evict(rw);
+  }
+  
+  if(rw->count == rw->entry_cap) {
+    rewind_entry_t *entries = malloc(sizeof *entries * rw->entry_cap * 2);
+    int             i;
+    
+    if(!entries)
+      return 0;
+    for(i = 0; i < rw->count; ++i)
+      entries[i] = *rewind_entry(rw, i);
+    
+    free(rw->entries);
+    rw->entries    = entries;
+    rw->entry_cap *= 2;
+    rw->first      = 0;
+  }
+  
+  memcpy(rw->ring + at, rw->code, size);
+  e         = rewind_entry(rw, rw->count++);
+  e->offset = at;
+  e->size   = size;
+  e->key    = key;
+  rw->used += size;
+  if(key) ++rw->keys;
+  return 1;
+}
+
+/* Sets up a ring of the given size in bytes, with a keyframe every interval
+ * frames. Work space for four states of the instance comes on top. Returns
+ * 0 if memory runs out. */
+int rewind_init(rewind_t *rw, gb_t *gb, size_t bytes, int interval) {
+  size_t size = WORDS(state_size(gb)) * sizeof(word_t);
+  
+  memset(rw, 0, sizeof *rw);
+  rw->ring_size  = bytes;
+  rw->interval   = (interval > 0) ? interval : 1;
+  rw->state_size = size;
+  rw->entry_cap  = 256;
+  
+  rw->ring    = malloc(bytes);
+  rw->entries = malloc(sizeof *rw->entries * rw->entry_cap);
+  rw->state   = calloc(1, size);
+  rw->next    = calloc(1, size);
+  rw->code    = malloc(size * 2 + 16);
+  
+  if(!rw->ring || !rw->entries || !rw->state || !rw->next || !rw->code) {
+    rewind_free(rw);
+    return 0;
+  }
+  return 1;
+}
+
+/* Records the current frame. Call once a frame, between gb_run()s. */
+void rewind_push(rewind_t *rw, gb_t *gb) {
+  size_t   len = state_save(gb, rw->next, rw->state_size, 0);
+  size_t   size;
+  uint8_t *t;
+  int      key;
+  
+  if(!len)
+    return;
+  
+  key = !rw->count || (rw->since_key + 1 >= rw->interval) || (len != rw->state_len);
+  if(!key) {
+    size = rewind_delta((const word_t *)rw->next, (const word_t *)rw->state,
+                        WORDS(len), rw->code);
+    
+    /* A delta too big for the ring as it is becomes a keyframe. */
+    if(!rewind_store(rw, size, 0))
+      key = 1;
+  }
+  
+  if(key) {
+    size = lz_compress(rw->next, len, rw->code);
+    if(!rewind_store(rw, size, 1)) {
+      rewind_clear(rw);
+      return;
+    }
+  }
+  
+  t              = rw->state;
+  rw->state      = rw->next;
+  rw->next       = t;
+  rw->state_len  = len;
+  rw->since_key  = key ? 0 : rw->since_key + 1;
+}
+
+/* Goes back a frame: forgets the newest and loads the one before it.
+ * Returns 0 if there is none. */
+int rewind_pop(rewind_t *rw, gb_t *gb) {
+  rewind_entry_t *e;
+  
+  if(rw->count < 2)
+    return 0;
+  
+  e = rewind_entry(rw, rw->count - 1);
+  if(!e->key) {
+    rewind_apply(rw->ring + e->offset, e->size, (word_t *)rw->state);
+    --rw->since_key;
+  }
+  
+  /* The frame before a keyframe comes from the keyframe before that and
+   * the deltas since. The ring always starts with a keyframe. */
+  else {
+    int i, k = rw->count - 2;
+    
+    while(!rewind_entry(rw, k)->key) --k;
+    
+    e = rewind_entry(rw, k);
+    memset(rw->state, 0, rw->state_size);
+    rw->state_len = lz_decompress(rw->ring + e->offset, e->size, rw->state, rw->state_size);
+    for(i = k + 1; i < rw->count - 1; ++i) {
+      e = rewind_entry(rw, i);
+      rewind_apply(rw->ring + e->offset, e->size, (word_t *)rw->state);
+    }
+    
+    rw->since_key = rw->count - 2 - k;
+    --rw->keys;
+    e = rewind_entry(rw, rw->count - 1);
+  }
+  
+  rw->used -= e->size;
+  --rw->count;
+  return state_load(gb, rw->state, rw->state_len);
+}
+
+/* Forgets every frame, as after loading a state from elsewhere. */
+void rewind_clear(rewind_t *rw) {
+  rw->count     = 0;
+  rw->first     = 0;
+  rw->used      = 0;
+  rw->keys      = 0;
+  rw->since_key = 0;
+}
+
+void rewind_free(rewind_t *rw) {
+  free(rw->ring);
+  free(rw->entries);
+  free(rw->state);
+  free(rw->next);
+  free(rw->code);
+  memset(rw, 0, sizeof *rw);
+}
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef ORCHARD_THREADS
+#include <pthread.h>
+#endif
+
+#include "rom.h"
+
+/* Every image someone holds. References are taken once per instance, not
+ * per access, so one lock covers the list and the counts. */
+static rom_t *store = NULL;
+
+#ifdef ORCHARD_THREADS
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK()   pthread_mutex_lock(&store_lock)
+#define UNLOCK() pthread_mutex_unlock(&store_lock)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+static void rom_free(rom_t *rom) {
+  if(!rom)
+    return;
+  
+  free((void *)rom->data);
+  free(rom->name);
+  free(rom);
+}
+
+/* Returns a held image by name, with a new reference. Call locked. */
+static rom_t *rom_find(const char *name) {
+  rom_t *rom;
+  
+  for(rom = store; rom; rom = rom->next) {
+    if(rom->name && !strcmp(rom->name, name)) {
+      ++rom->refs;
+      return rom;
+    }
+  }
+  
+  return NULL;
+}
+
+/* Adds an image to the store, or returns the one that got there first under
+ * the same name. Call locked. */
+static rom_t *rom_add(rom_t *rom) {
+  rom_t *held = rom->name ? rom_find(rom->name) : NULL;
+  
+  if(held) {
+    rom_free(rom);
+    return held;
+  }
+  
+  rom->next = store;
+  store     = rom;
+  return rom;
+}
+
+/* Copies size bytes of data into a new image, padded to whole banks. */
+static rom_t *rom_alloc(const char *name, size_t size) {
+  rom_t  *rom    = calloc(1, sizeof *rom);
+  size_t  padded = (size + 0x3fff) & ~(size_t)0x3fff;
+  
+  if(padded < 0x8000)
+    padded = 0x8000;
+  
+  if(!rom || !(rom->data = malloc(padded)) || (name && !(rom->name = strdup(name)))) {
+    rom_free(rom);
+    return NULL;
+  }
+  
+  memset((uint8_t *)rom->data + size, 0xff, padded - size);
+  rom->size  = padded;
+  rom->banks = padded / 0x4000;
+  rom->refs  = 1;
+  return rom;
+}
+
+/* Returns the image of a ROM file, reading it only if nobody holds it
+ * already. Returns NULL if the file can't be read. */
+rom_t *rom_open(const char *name) {
+  rom_t *rom;
+  FILE  *f;
+  long   size;
+  
+  LOCK();
+  rom = rom_find(name);
+  UNLOCK();
+  if(rom)
+    return rom;
+  
+  if(!(f = fopen(name, "rb")))
+    return NULL;
+  
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  
+  if((size <= 0) || !(rom = rom_alloc(name, size))) {
+    fclose(f);
+    return NULL;
+  }
+  if(fread((uint8_t *)rom->data, 1, size, f) != (size_t)size) {
+    fclose(f);
+    rom_free(rom);
+    return NULL;
+  }
+  fclose(f);
+  
+  LOCK();
+  rom = rom_add(rom);
+  UNLOCK();
+  return rom;
+}
+
+/* Makes an image from data already in memory. Named images are shared like
+ * files; a NULL name makes a private one. Returns NULL if memory runs out. */
+rom_t *rom_create(const char *name, const uint8_t *data, size_t size) {
+  rom_t *rom = rom_alloc(name, size);
+  
+  if(!rom)
+    return NULL;
+  memcpy((uint8_t *)rom->data, data, size);
+  
+  LOCK();
+  rom = rom_add(rom);
+  UNLOCK();
+  return rom;
+}
+
+rom_t *rom_ref(rom_t *rom) {
+  LOCK();
+  ++rom->refs;
+  UNLOCK();
+  return rom;
+}
+
+/* Drops a reference, freeing the image with the last one. */
+void rom_unref(rom_t *rom) {
+  rom_t **p;
+  
+  if(!rom)
+    return;
+  
+  LOCK();
+  if(--rom->refs) {
+    UNLOCK();
+    return;
+  }
+  for(p = &store; *p != rom; p = &(*p)->next);
+  *p = rom->next;
+  UNLOCK();
+  
+  rom_free(rom);
+}
+
+/* Counts the images held and their bytes. */
+void rom_stats(int *images, size_t *bytes) {
+  rom_t *rom;
+  
+  *images = 0;
+  *bytes  = 0;
+  
+  LOCK();
+  for(rom = store; rom; rom = rom->next) {
+    ++*images;
+    *bytes += rom->size;
+  }
+  UNLOCK();
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "apu.h"
+#include "bgcache.h"
+#include "gb.h"
+#include "runahead.h"
+#include "serial.h"
+#include "state.h"
+
+/* Makes room for the instance's state. Returns 0 when out of memory.
+ * Loading a state throws the background cache away, so with frames to run
+ * ahead it would be rebuilt for every frame shown, which costs more than
+ * drawing without it; it is turned off instead. */
+int runahead_init(runahead_t *ra, gb_t *gb, int frames) {
+  memset(ra, 0, sizeof *ra);
+  ra->frames = (frames > 0) ? frames : 0;
+  ra->size   = state_size(gb);
+  ra->state  = malloc(ra->size);
+  if(ra->frames) bgcache_enable(gb, 0);
+  return ra->state != NULL;
+}
+
+/* Runs one displayed frame in the instance's render mode, queued or not. A
+ * frame that won't be drawn has nothing to run ahead for, so it is just the
+ * real one.
+ * 
+ * The frame shown starts at the VBlank in the call before the last, which
+ * is the real one when running a single frame ahead, so rendering is queued
+ * for that VBlank. */
+void runahead_run(runahead_t *ra, gb_t *gb) {
+  gb_render_mode_t mode = gb->render_next;
+  serial_hook_t    hook = gb->serial.hook;
+  size_t           n;
+  int              i;
+  
+  if(!ra->frames) {
+    gb_run(gb);
+    return;
+  }
+  
+  gb_set_render_mode(gb, GB_RENDER_NONE);
+  if(mode == GB_RENDER_NONE) {
+    gb_run(gb);
+    return;
+  }
+  
+  if(ra->frames == 1) gb_queue_render_mode(gb, mode);
+  gb_run(gb);
+  n = state_save(gb, ra->state, ra->size, 0);
+  
+  apu_hold(gb, 1);
+  serial_set_hook(gb, NULL);
+  for(i = 1; i <= ra->frames; ++i) {
+    if(i == ra->frames - 1) gb_queue_render_mode(gb, mode);
+    if(i == ra->frames)     gb_set_render_mode(gb, mode);
+    gb_run(gb);
+  }
+  
+  state_load(gb, ra->state, n);
+  serial_set_hook(gb, hook);
+  apu_hold(gb, 0);
+}
+
+void runahead_free(runahead_t *ra) {
+  free(ra->state);
+  ra->state = NULL;
+}
@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "scale.h"
+
+/* Expands a 5-bit channel to 8 bits. */
+#define EXPAND5(c) (((c) << 3) | ((c) >> 2))
+
+void scale_convert_generic(const uint16_t *src, uint32_t *dst, int n) {
+  int i;
+  
+  for(i = 0; i < n; ++i) {
+    uint32_t r = src[i] & 0x1f, g = (src[i] >> 5) & 0x1f, b = (src[i] >> 10) & 0x1f;
+    dst[i] = EXPAND5(r) | (EXPAND5(g) << 8) | (EXPAND5(b) << 16) | 0xff000000;
+  }
+}
+
+void scale_repeat_generic(const uint32_t *src, uint32_t *dst, int n, int factor) {
+  int i, j;
+  
+  for(i = 0; i < n; ++i)
+    for(j = 0; j < factor; ++j)
+      *dst++ = src[i];
+}
+
+/* Blends two rows: dst = (a * (256 - fy) + b * fy) / 256, per channel. */
+void scale_blend_generic(const uint32_t *a, const uint32_t *b, uint32_t *dst, int n, int fy) {
+  int i, c;
+  
+  for(i = 0; i < n; ++i) {
+    uint32_t out = 0;
+    
+    for(c = 0; c < 32; c += 8) {
+      uint32_t ca = (a[i] >> c) & 0xff, cb = (b[i] >> c) & 0xff;
+      out |= ((ca * (256 - fy) + cb * fy) >> 8) << c;
+    }
+    dst[i] = out;
+  }
+}
+
+/* Resamples a row horizontally: output pixel i blends src[x0[i]] and
+ * src[x0[i] + 1] with weight fx[i] on the second. */
+void scale_stretch_generic(const uint32_t *src, uint32_t *dst, const uint16_t *x0,
+                           const uint16_t *fx, int n) {
+  int i;
+  
+  for(i = 0; i < n; ++i)
+    scale_blend_generic(&src[x0[i]], &src[x0[i] + 1], &dst[i], 1, fx[i]);
+}
+
+#ifdef __SSE2__
+void scale_convert(const uint16_t *src, uint32_t *dst, int n) {
+  const __m128i mask  = _mm_set1_epi16(0x1f);
+  const __m128i alpha = _mm_set1_epi16((short)0xff00);
+  int           i;
+  
+  for(i = 0; i + 8 <= n; i += 8) {
+    __m128i p  = _mm_loadu_si128((const __m128i *)&src[i]);
+    __m128i r  = _mm_and_si128(p, mask);
+    __m128i g  = _mm_and_si128(_mm_srli_epi16(p, 5),  mask);
+    __m128i b  = _mm_and_si128(_mm_srli_epi16(p, 10), mask);
+    __m128i rg, ba;
+    
+    r  = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+    g  = _mm_or_si128(_mm_slli_epi16(g, 3), _mm_srli_epi16(g, 2));
+    b  = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+    rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+    ba = _mm_or_si128(b, alpha);
+    
+    _mm_storeu_si128((__m128i *)&dst[i],     _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i *)&dst[i + 4], _mm_unpackhi_epi16(rg, ba));
+  }
+  
+  scale_convert_generic(&src[i], &dst[i], n - i);
+}
+
+void scale_repeat(const uint32_t *src, uint32_t *dst, int n, int factor) {
+  int i;
+  
+  for(i = 0; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&src[i]);
+    
+    switch(factor) {
+      case 2:
+        _mm_storeu_si128((__m128i *)&dst[0], _mm_unpacklo_epi32(v, v));
+        _mm_storeu_si128((__m128i *)&dst[4], _mm_unpackhi_epi32(v, v));
+        break;
+      case 3:
+        _mm_storeu_si128((__m128i *)&dst[0], _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 0, 0)));
+        _mm_storeu_si128((__m128i *)&dst[4], _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 1, 1)));
+        _mm_storeu_si128((__m128i *)&dst[8], _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 2)));
+        break;
+      case 4:
+        _mm_storeu_si128((__m128i *)&dst[0],  _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 0, 0, 0)));
+        _mm_storeu_si128((__m128i *)&dst[4],  _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 1, 1, 1)));
+        _mm_storeu_si128((__m128i *)&dst[8],  _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 2, 2)));
+        _mm_storeu_si128((__m128i *)&dst[12], _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3)));
+        break;
+      default:
+        scale_repeat_generic(&src[i], dst, 4, factor);
+        break;
+    }
+    dst += 4 * factor;
+  }
+  
+  scale_repeat_generic(&src[i], dst, n - i, factor);
+}
+
+void scale_blend(const uint32_t *a, const uint32_t *b, uint32_t *dst, int n, int fy) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i wa   = _mm_set1_epi16(256 - fy);
+  const __m128i wb   = _mm_set1_epi16(fy);
+  int           i;
+  
+  for(i = 0; i + 4 <= n; i += 4) {
+    __m128i va = _mm_loadu_si128((const __m128i *)&a[i]);
+    __m128i vb = _mm_loadu_si128((const __m128i *)&b[i]);
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), wa),
+                               _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb));
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), wa),
+                               _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb));
+    
+    lo = _mm_srli_epi16(lo, 8);
+    hi = _mm_srli_epi16(hi, 8);
+    _mm_storeu_si128((__m128i *)&dst[i], _mm_packus_epi16(lo, hi));
+  }
+  
+  scale_blend_generic(&a[i], &b[i], &dst[i], n - i, fy);
+}
+
+void scale_stretch(const uint32_t *src, uint32_t *dst, const uint16_t *x0,
+                   const uint16_t *fx, int n) {
+  const __m128i zero = _mm_setzero_si128();
+  int           i;
+  
+  /* Two output pixels per step. Each source pair is widened to 16 bits per
+   * channel and weighted, then the halves are summed. */
+  for(i = 0; i + 2 <= n; i += 2) {
+    __m128i p0 = _mm_loadl_epi64((const __m128i *)&src[x0[i]]);
+    __m128i p1 = _mm_loadl_epi64((const __m128i *)&src[x0[i + 1]]);
+    __m128i w0 = _mm_unpacklo_epi64(_mm_set1_epi16(256 - fx[i]),     _mm_set1_epi16(fx[i]));
+    __m128i w1 = _mm_unpacklo_epi64(_mm_set1_epi16(256 - fx[i + 1]), _mm_set1_epi16(fx[i + 1]));
+    __m128i m0 = _mm_mullo_epi16(_mm_unpacklo_epi8(p0, zero), w0);
+    __m128i m1 = _mm_mullo_epi16(_mm_unpacklo_epi8(p1, zero), w1);
+    __m128i s  = _mm_add_epi16(_mm_unpacklo_epi64(m0, m1), _mm_unpackhi_epi64(m0, m1));
+    
+    s = _mm_srli_epi16(s, 8);
+    _mm_storel_epi64((__m128i *)&dst[i], _mm_packus_epi16(s, s));
+  }
+  
+  scale_stretch_generic(src, &dst[i], &x0[i], &fx[i], n - i);
+}
+#else
+void scale_convert(const uint16_t *src, uint32_t *dst, int n) {
+  scale_convert_generic(src, dst, n);
+}
+
+void scale_repeat(const uint32_t *src, uint32_t *dst, int n, int factor) {
+  scale_repeat_generic(src, dst, n, factor);
+}
+
+void scale_blend(const uint32_t *a, const uint32_t *b, uint32_t *dst, int n, int fy) {
+  scale_blend_generic(a, b, dst, n, fy);
+}
+
+void scale_stretch(const uint32_t *src, uint32_t *dst, const uint16_t *x0,
+                   const uint16_t *fx, int n) {
+  scale_stretch_generic(src, dst, x0, fx, n);
+}
+#endif
+
+/* Maps output coordinate i of n onto a source of size m, sampling at pixel
+ * centers. Returns the first source pixel and stores the weight of the next
+ * one, in 256ths. */
+static int scale_map(int i, int n, int m, uint16_t *weight) {
+  int pos = ((2*i + 1) * m - n) * 128 / n; /* Source position, in 256ths. */
+  
+  if(pos < 0) pos = 0;
+  if(pos >= (m - 1) * 256) {
+    *weight = 0;
+    return m - 1;
+  }
+  
+  *weight = pos & 0xff;
+  return pos >> 8;
+}
+
+/* Sets up a scaler writing width x height pixels to dst, pitch pixels apart.
+ * Returns 0 if the size is unsupported. */
+int scaler_init(scaler_t *s, uint32_t *dst, int pitch, int width, int height) {
+  int i;
+  
+  if((width <= 0) || (height <= 0) || (width > SCALE_MAX_WIDTH) ||
+     (height > SCALE_MAX_HEIGHT))
+    return 0;
+  
+  memset(s, 0, sizeof *s);
+  s->dst    = dst;
+  s->pitch  = pitch;
+  s->width  = width;
+  s->height = height;
+  
+  for(i = 2; i <= 4; ++i)
+    if((width == 160 * i) && (height == 144 * i))
+      s->factor = i;
+  
+  for(i = 0; i < width; ++i)
+    s->col_x0[i] = scale_map(i, width, 160, &s->col_fx[i]);
+  
+  for(i = 0; i < height; ++i)
+    s->row_y0[i] = scale_map(i, height, 144, &s->row_fy[i]);
+  
+  /* first_row[y] is the first output row whose upper source row is y or
+   * later. */
+  for(i = 0; i < 145; ++i) {
+    int row = (i > 0) ? s->first_row[i - 1] : 0;
+    while((row < height) && (s->row_y0[row] < i)) ++row;
+    s->first_row[i] = row;
+  }
+  
+  return 1;
+}
+
+/* Sets up a scaler replicating pixels by the largest factor, up to 4, that
+ * fits width x height, in the middle of it. The border is cleared to black
+ * once here; the picture is written over the rest. Returns 0 if not even
+ * 2x fits. */
+int scaler_init_integer(scaler_t *s, uint32_t *dst, int pitch, int width, int height) {
+  int factor, x, y;
+  
+  if((width > SCALE_MAX_WIDTH) || (height > SCALE_MAX_HEIGHT))
+    return 0;
+  
+  for(factor = 4; factor >= 2; --factor)
+    if((width >= 160 * factor) && (height >= 144 * factor))
+      break;
+  if(factor < 2)
+    return 0;
+  
+  for(y = 0; y < height; ++y)
+    for(x = 0; x < width; ++x)
+      dst[y * pitch + x] = 0xff000000;
+  
+  x = (width  - 160 * factor) / 2;
+  y = (height - 144 * factor) / 2;
+  return scaler_init(s, &dst[y * pitch + x], pitch, 160 * factor, 144 * factor);
+}
+
+/* Writes the output rows sampling between source rows y and y+1. */
+static void scaler_rows(scaler_t *s, int y) {
+  uint32_t line[161];
+  int      row;
+  
+  for(row = s->first_row[y]; row < s->first_row[y + 1]; ++row) {
+    int y1 = (y < 143) ? y + 1 : y;
+    
+    scale_blend(s->frame[y], s->frame[y1], line, 161, s->row_fy[row]);
+    scale_stretch(line, &s->dst[row * s->pitch], s->col_x0, s->col_fx, s->width);
+  }
+  
+  s->pending[y] = 0;
+}
+
+/* Feeds line ly (160 RGB15 pixels) to the scaler, which writes the output
+ * rows that depend on it. Lines may arrive in any order, or not at all when
+ * they didn't change. Bilinear rows below ly wait for line ly+1 or for
+ * scaler_flush(). */
+void scaler_line(scaler_t *s, int ly, const uint16_t *src) {
+  uint32_t line[160 * 4];
+  int      row;
+  
+  if(s->factor) {
+    uint32_t *dst = &s->dst[ly * s->factor * s->pitch];
+    
+    scale_convert(src, line, 160);
+    scale_repeat(line, dst, 160, s->factor);
+    for(row = 1; row < s->factor; ++row)
+      memcpy(&dst[row * s->pitch], dst, s->width * sizeof *dst);
+    return;
+  }
+  
+  scale_convert(src, s->frame[ly], 160);
+  s->frame[ly][160] = s->frame[ly][159];
+  
+  /* Rows above this line now have both of their source lines. */
+  if(ly > 0) scaler_rows(s, ly - 1);
+  
+  if(ly < 143) s->pending[ly] = 1;
+  else         scaler_rows(s, ly);
+}
+
+/* Writes any bilinear rows still waiting on a line that never came, which
+ * happens when the line below didn't change. Call once per frame. */
+void scaler_flush(scaler_t *s) {
+  int y;
+  
+  if(s->factor)
+    return;
+  
+  for(y = 0; y < 144; ++y)
+    if(s->pending[y]) scaler_rows(s, y);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "apu.h"
+#include "cgb.h"
+#include "gb.h"
+#include "sched.h"
+#include "serial.h"
+#include "z80.h"
+
+/* How far ahead sched_next points when nothing is scheduled. */
+#define IDLE_DOTS 0x40000000
+
+#define sched (gb->sched)
+
+typedef void (*sched_handler_t)(gb_t *gb);
+
+/* What runs when each event falls due. */
+static const sched_handler_t handlers[SCHED_EVENTS] = {
+  cgb_hblank,
+  z80_dma_end,
+  apu_step,
+  serial_done
+};
+
+/* Returns the current time. */
+uint32_t sched_time(gb_t *gb) {
+  return sched.base + (sched.span - sched.left);
+}
+
+/* Counts down from now to the earliest scheduled event. */
+static void sched_update(gb_t *gb) {
+  uint32_t now  = sched_time(gb);
+  int32_t  left = IDLE_DOTS;
+  int      i;
+  
+  for(i = 0; i < SCHED_EVENTS; ++i) {
+    if((sched.pending & (1 << i)) && ((int32_t)(sched.when[i] - now) < left))
+      left = sched.when[i] - now;
+  }
+  
+  sched.base = now;
+  sched.span = left;
+  sched.left = left;
+}
+
+/* Drops every scheduled event and starts time over. */
+void sched_reset(gb_t *gb) {
+  memset(&sched, 0, sizeof sched);
+  sched_update(gb);
+}
+
+/* Has the event's handler called delay dots from now, replacing any earlier
+ * schedule of the same event. */
+void sched_at(gb_t *gb, sched_event_t event, uint32_t delay) {
+  sched.when[event] = sched_time(gb) + delay;
+  sched.pending    |= 1 << event;
+  sched_update(gb);
+}
+
+/* Has the handler called period dots after the event was last due, so
+ * periodic events don't drift by however late they ran. */
+void sched_repeat(gb_t *gb, sched_event_t event, uint32_t period) {
+  sched.when[event] += period;
+  sched.pending     |= 1 << event;
+  sched_update(gb);
+}
+
+void sched_cancel(gb_t *gb, sched_event_t event) {
+  sched.pending &= ~(1 << event);
+  sched_update(gb);
+}
+
+/* Runs every event that is due. Handlers may schedule again, including the
+ * event being run. */
+void sched_run(gb_t *gb) {
+  uint32_t now = sched_time(gb);
+  int      i;
+  
+  for(i = 0; i < SCHED_EVENTS; ++i) {
+    if((sched.pending & (1 << i)) && ((int32_t)(now - sched.when[i]) >= 0)) {
+      sched.pending &= ~(1 << i);
+      handlers[i](gb);
+    }
+  }
+  
+  sched_update(gb);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdint.h>
+
+#include "gb.h"
+#include "sched.h"
+#include "serial.h"
+#include "z80.h"
+
+/* Eight bits at 8192 Hz. */
+#define TRANSFER_DOTS 4096
+
+#define SB MMAP(0x01)
+#define SC MMAP(0x02)
+
+#define serial (gb->serial)
+
+/* Finishes a transfer: the byte leaves, and nothing comes back. */
+void serial_done(gb_t *gb) {
+  SB  = 0xff;
+  SC &= 0x7f;
+  IF |= 0x08;
+  
+  if(serial.hook) serial.hook(gb, serial.out);
+}
+
+/* Starts with the port idle. The hook is kept. */
+void serial_reset(gb_t *gb) {
+  SB = 0x00;
+  SC = 0x7e;
+}
+
+void serial_set_hook(gb_t *gb, serial_hook_t hook) {
+  serial.hook = hook;
+}
+
+/* Handles writes to SB and SC. Setting bits 7 and 0 of SC starts a transfer
+ * on the internal clock, which runs at twice the rate in double-speed mode. */
+void serial_write(gb_t *gb, uint16_t addr, uint8_t value) {
+  if(addr == 0xff01) {
+    SB = value;
+    return;
+  }
+  
+  SC = value | 0x7e;
+  if((value & 0x81) == 0x81) {
+    serial.out = SB;
+    sched_at(gb, SCHED_SERIAL, TRANSFER_DOTS >> gb->cgb.speed);
+  }
+  else {
+    sched_cancel(gb, SCHED_SERIAL);
+  }
+}
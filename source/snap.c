@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "snap.h"
+
+#define PRIME 0x9e3779b97f4a7c15ull
+
+#define PAGE(st, i) (&((snap_page_t *)(st)->pages.items)[i])
+#define SNAP(st, i) (&((snap_t *)(st)->snaps.items)[i])
+
+/* 64-bit hash in four lanes, so the multiplies overlap. Pages are compared
+ * in full when the hash matches, so it only has to spread them well. */
+static uint64_t snap_hash(const void *data, size_t size) {
+  const uint8_t *p = data;
+  uint64_t       h[4] = { PRIME, PRIME * 3, PRIME * 5, PRIME * 7 };
+  uint64_t       x = size;
+  int            i;
+  
+  for(; size >= 32; size -= 32, p += 32) {
+    for(i = 0; i < 4; ++i) {
+      uint64_t w;
+      
+      memcpy(&w, p + i * 8, 8);
+      h[i]  = (h[i] ^ w) * PRIME;
+      h[i] ^= h[i] >> 31;
+    }
+  }
+  for(; size; --size) h[0] = (h[0] ^ *p++) * PRIME;
+  
+  for(i = 0; i < 4; ++i) {
+    x  = (x ^ h[i]) * PRIME;
+    x ^= x >> 29;
+  }
+  return x;
+}
+
+static snap_entry_t *snap_entry(snap_table_t *t, size_t item, uint32_t i) {
+  return (snap_entry_t *)((uint8_t *)t->items + i * item);
+}
+
+static int snap_table_init(snap_table_t *t, size_t item) {
+  memset(t, 0, sizeof *t);
+  t->cap     = 256;
+  t->mask    = 255;
+  t->free    = SNAP_NONE;
+  t->items   = malloc(item * t->cap);
+  t->buckets = malloc(sizeof *t->buckets * (t->mask + 1));
+  if(!t->items || !t->buckets)
+    return 0;
+  memset(t->buckets, 0xff, sizeof *t->buckets * (t->mask + 1));
+  return 1;
+}
+
+/* Doubles the buckets once there are more entries than buckets. */
+static void snap_rehash(snap_table_t *t, size_t item) {
+  uint32_t  mask    = t->mask * 2 + 1;
+  uint32_t *buckets = malloc(sizeof *buckets * (mask + 1));
+  uint32_t  i;
+  
+  if(!buckets)
+    return;
+  memset(buckets, 0xff, sizeof *buckets * (mask + 1));
+  
+  for(i = 0; i < t->used; ++i) {
+    snap_entry_t *e = snap_entry(t, item, i);
+    
+    if(!e->refs)
+      continue;
+    e->next = buckets[e->hash & mask];
+    buckets[e->hash & mask] = i;
+  }
+  
+  free(t->buckets);
+  t->buckets = buckets;
+  t->mask    = mask;
+}
+
+/* Hands out an entry with the hash, holding one reference, and chains it.
+ * Returns SNAP_NONE if memory runs out. */
+static uint32_t snap_alloc(snap_table_t *t, size_t item, uint64_t hash) {
+  snap_entry_t *e;
+  uint32_t      i;
+  
+  if(t->free != SNAP_NONE) {
+    i       = t->free;
+    t->free = snap_entry(t, item, i)->next;
+  }
+  else {
+    if(t->used == t->cap) {
+      void *items = realloc(t->items, item * t->cap * 2);
+      
+      if(!items)
+        return SNAP_NONE;
+      t->items = items;
+      t->cap  *= 2;
+    }
+    i = t->used++;
+  }
+  
+  e       = snap_entry(t, item, i);
+  e->hash = hash;
+  e->refs = 1;
+  e->next = t->buckets[hash & t->mask];
+  t->buckets[hash & t->mask] = i;
+  
+  if(++t->live > t->mask + 1)
+    snap_rehash(t, item);
+  return i;
+}
+
+/* Takes an entry out of its chain and puts it on the free list. */
+static void snap_unlink(snap_table_t *t, size_t item, uint32_t i) {
+  snap_entry_t *e    = snap_entry(t, item, i);
+  uint32_t     *link = &t->buckets[e->hash & t->mask];
+  
+  while(*link != i)
+    link = &snap_entry(t, item, *link)->next;
+  *link   = e->next;
+  e->next = t->free;
+  t->free = i;
+  --t->live;
+}
+
+/* Finds a page with this content, taking a reference when add is set and
+ * storing it first if there is none. Returns SNAP_NONE for none, or if
+ * memory runs out. */
+static uint32_t snap_page(snap_store_t *st, const uint8_t *data, uint32_t size, int add) {
+  uint64_t     hash = snap_hash(data, size);
+  snap_page_t *page;
+  uint32_t     i;
+  
+  for(i = st->pages.buckets[hash & st->pages.mask]; i != SNAP_NONE; i = page->e.next) {
+    page = PAGE(st, i);
+    if((page->e.hash == hash) && (page->size == size) && !memcmp(page->data, data, size)) {
+      if(add) ++page->e.refs;
+      return i;
+    }
+  }
+  
+  if(!add)
+    return SNAP_NONE;
+  
+  if((i = snap_alloc(&st->pages, sizeof *page, hash)) == SNAP_NONE)
+    return SNAP_NONE;
+  page       = PAGE(st, i);
+  page->size = size;
+  if(!(page->data = malloc(size))) {
+    page->e.refs = 0;
+    snap_unlink(&st->pages, sizeof *page, i);
+    return SNAP_NONE;
+  }
+  memcpy(page->data, data, size);
+  st->stored += size;
+  return i;
+}
+
+static void snap_page_unref(snap_store_t *st, uint32_t i) {
+  snap_page_t *page = PAGE(st, i);
+  
+  if(--page->e.refs)
+    return;
+  st->stored -= page->size;
+  free(page->data);
+  page->data = NULL;
+  snap_unlink(&st->pages, sizeof *page, i);
+}
+
+/* Cuts a state into pages, finding each in the store or, with add set,
+ * storing it, and leaves their numbers in scratch. Returns how many pages
+ * there are, or 0 if one isn't there or memory runs out; pages taken by
+ * then are let go. */
+static uint32_t snap_cut(snap_store_t *st, const uint8_t *state, size_t size, int add) {
+  size_t   first = (st->offset < size) ? st->offset : size;
+  uint32_t count = (first > 0) + (uint32_t)((size - first + SNAP_PAGE - 1) / SNAP_PAGE);
+  uint32_t n;
+  size_t   at;
+  
+  if(count > st->scratch_cap) {
+    uint32_t *scratch = realloc(st->scratch, sizeof *scratch * count);
+    
+    if(!scratch)
+      return 0;
+    st->scratch     = scratch;
+    st->scratch_cap = count;
+  }
+  
+  for(n = 0, at = 0; n < count; ++n) {
+    size_t len = (!n && first) ? first : (size - at < SNAP_PAGE) ? size - at : SNAP_PAGE;
+    
+    if((st->scratch[n] = snap_page(st, state + at, len, add)) == SNAP_NONE) {
+      while(add && n) snap_page_unref(st, st->scratch[--n]);
+      return 0;
+    }
+    at += len;
+  }
+  return count;
+}
+
+/* Finds the snapshot made of the pages in scratch. */
+static uint32_t snap_lookup(snap_store_t *st, uint64_t hash, uint32_t count, size_t size) {
+  uint32_t i;
+  
+  for(i = st->snaps.buckets[hash & st->snaps.mask]; i != SNAP_NONE; i = SNAP(st, i)->e.next) {
+    snap_t *snap = SNAP(st, i);
+    
+    if((snap->e.hash == hash) && (snap->count == count) && (snap->size == size) &&
+       !memcmp(snap->pages, st->scratch, sizeof *snap->pages * count))
+      return i;
+  }
+  return SNAP_NONE;
+}
+
+/* Sets up an empty store cutting states into pages from offset on. Returns
+ * 0 if memory runs out. */
+int snap_init(snap_store_t *st, size_t offset) {
+  memset(st, 0, sizeof *st);
+  st->offset = offset;
+  if(!snap_table_init(&st->pages, sizeof(snap_page_t)) ||
+     !snap_table_init(&st->snaps, sizeof(snap_t))) {
+    snap_free(st);
+    return 0;
+  }
+  return 1;
+}
+
+/* Stores a state, or takes another reference to it if it is already held,
+ * and returns its handle: SNAP_NONE if memory runs out. */
+uint32_t snap_insert(snap_store_t *st, const void *state, size_t size) {
+  uint32_t count = snap_cut(st, state, size, 1);
+  uint64_t hash;
+  snap_t  *snap;
+  uint32_t i;
+  
+  if(!count)
+    return SNAP_NONE;
+  
+  hash = snap_hash(st->scratch, sizeof *st->scratch * count) ^ size;
+  if((i = snap_lookup(st, hash, count, size)) != SNAP_NONE) {
+    while(count) --PAGE(st, st->scratch[--count])->e.refs;
+    ++SNAP(st, i)->e.refs;
+    st->held += size;
+    return i;
+  }
+  
+  if((i = snap_alloc(&st->snaps, sizeof *snap, hash)) == SNAP_NONE)
+    goto fail;
+  snap = SNAP(st, i);
+  if(!(snap->pages = malloc(sizeof *snap->pages * count))) {
+    snap->e.refs = 0;
+    snap_unlink(&st->snaps, sizeof *snap, i);
+    goto fail;
+  }
+  memcpy(snap->pages, st->scratch, sizeof *snap->pages * count);
+  snap->count = count;
+  snap->size  = size;
+  st->held   += size;
+  return i;
+  
+fail:
+  while(count) snap_page_unref(st, st->scratch[--count]);
+  return SNAP_NONE;
+}
+
+/* Returns the handle of a state if the store holds it, or SNAP_NONE. */
+uint32_t snap_find(snap_store_t *st, const void *state, size_t size) {
+  uint32_t count = snap_cut(st, state, size, 0);
+  
+  if(!count)
+    return SNAP_NONE;
+  return snap_lookup(st, snap_hash(st->scratch, sizeof *st->scratch * count) ^ size,
+    count, size);
+}
+
+/* Puts a snapshot back together in buf, which holds size bytes. Returns
+ * the size of the state, or 0 if it doesn't fit. */
+size_t snap_restore(snap_store_t *st, uint32_t i, void *buf, size_t size) {
+  snap_t  *snap = SNAP(st, i);
+  uint8_t *out  = buf;
+  uint32_t n;
+  
+  if(size < snap->size)
+    return 0;
+  
+  for(n = 0; n < snap->count; ++n) {
+    const snap_page_t *page = PAGE(st, snap->pages[n]);
+    
+    memcpy(out, page->data, page->size);
+    out += page->size;
+  }
+  return snap->size;
+}
+
+/* Lets go of a reference to a snapshot, and of its pages with the last. */
+void snap_release(snap_store_t *st, uint32_t i) {
+  snap_t  *snap = SNAP(st, i);
+  uint32_t n;
+  
+  st->held -= snap->size;
+  if(--snap->e.refs)
+    return;
+  
+  for(n = 0; n < snap->count; ++n) snap_page_unref(st, snap->pages[n]);
+  free(snap->pages);
+  snap->pages = NULL;
+  snap_unlink(&st->snaps, sizeof *snap, i);
+}
+
+void snap_free(snap_store_t *st) {
+  uint32_t i;
+  
+  for(i = 0; i < st->pages.used; ++i) free(PAGE(st, i)->data);
+  for(i = 0; i < st->snaps.used; ++i) free(SNAP(st, i)->pages);
+  free(st->pages.items);
+  free(st->pages.buckets);
+  free(st->snaps.items);
+  free(st->snaps.buckets);
+  free(st->scratch);
+  memset(st, 0, sizeof *st);
+}
@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2010 Forest Belton (apples)
+ * 
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ * 
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "apu.h"
+#include "cart.h"
+#include "fork.h"
+#include "gb.h"
+#include "lz.h"
+#include "state.h"
+#include "z80.h"
+
+/* Fields declared int in gb_t are stored as 4 bytes. */
+typedef char state_int_is_32_bits[(sizeof(int) == 4) ? 1 : -1];
+
+/* Copies len bytes of gb at field to or from the blob at p, or only counts
+ * them when p is NULL. Forking copies them from the same place in another
+ * instance instead. */
+#define RANGE(field, len) do {                                           \
+    if(from)                                                             \
+      memcpy((field), (const uint8_t *)from +                            \
+        ((const uint8_t *)(field) - (const uint8_t *)gb), (len));        \
+    else if(p) {                                                         \
+      if(save) memcpy(p + n, (field), (len));                            \
+      else     memcpy((field), p + n, (len));                            \
+    }                                                                    \
+    n += (len);                                                          \
+  } while(0)
+
+#define FIELD(x) RANGE(&(x), sizeof(x))
+
+/* A page of memory a fork may share; see fork.h. Saving takes what it holds
+ * now, and loading comes after fork_drop(). */
+#define SLOT(slot) do {                                                  \
+    if(from)                                                             \
+      fork_share(gb, from, (slot));                                      \
+    else if(p) {                                                         \
+      if(save) memcpy(p + n, fork_data(gb, (slot)), FORK_PAGE);          \
+      else     memcpy(fork_own(gb, (slot)), p + n, FORK_PAGE);           \
+    }                                                                    \
+    n += FORK_PAGE;                                                      \
+  } while(0)
+
+/* Walks every field of the layout, saving to p or loading from it, or
+ * forking from another instance, and returns the size of the layout. The
+ * order here is the format; changing it means a new STATE_VERSION. */
+static size_t state_fields(gb_t *gb, uint8_t *p, int save, gb_t *from) {
+  size_t n = 0;
+  int    i, slots = fork_slots(gb);
+  
+  /* CPU, timers and DMA. */
+  FIELD(gb->af);
+  FIELD(gb->bc);
+  FIELD(gb->de);
+  FIELD(gb->hl);
+  FIELD(gb->sp);
+  FIELD(gb->pc);
+  FIELD(gb->ime);
+  FIELD(gb->bus_locked);
+  FIELD(gb->stall);
+  FIELD(gb->timer_counter);
+  FIELD(gb->div_counter);
+  
+  /* Scheduler: the time, and when each pending event is due. */
+  FIELD(gb->sched.left);
+  FIELD(gb->sched.span);
+  FIELD(gb->sched.base);
+  FIELD(gb->sched.when);
+  FIELD(gb->sched.pending);
+  
+  /* LCD, with the lines logged this frame and not yet rendered. */
+  FIELD(gb->scanline);
+  FIELD(gb->window_line);
+  FIELD(gb->lcd_dirty);
+  FIELD(gb->lcd_pending);
+  FIELD(gb->lcd_epoch);
+  FIELD(gb->log_first);
+  FIELD(gb->log_end);
+  for(i = 0; i < 144; ++i) {
+    FIELD(gb->line_log[i].regs);
+    FIELD(gb->line_log[i].epoch);
+  }
+  
+  /* Joypad and serial port. */
+  FIELD(gb->pad.select);
+  FIELD(gb->pad.lines);
+  FIELD(gb->serial.out);
+  
+  /* Bank controller. */
+  FIELD(gb->cart.ram_enabled);
+  FIELD(gb->cart.mode);
+  FIELD(gb->cart.bank);
+  FIELD(gb->cart.bank2);
+  
+  /* CGB registers and palettes. */
+  FIELD(gb->cgb.enabled);
+  FIELD(gb->cgb.speed);
+  FIELD(gb->cgb.vram_bank);
+  FIELD(gb->cgb.wram_bank);
+  FIELD(gb->cgb.hdma_active);
+  FIELD(gb->cgb.hdma_blocks);
+  FIELD(gb->cgb.hdma_src);
+  FIELD(gb->cgb.hdma_dst);
+  FIELD(gb->cgb.bg_pal);
+  FIELD(gb->cgb.obj_pal);
+  FIELD(gb->cgb.lut);
+  
+  /* The APU's register side; the synthesizer is rebuilt from it. */
+  FIELD(gb->apu.regs);
+  FIELD(gb->apu.power);
+  FIELD(gb->apu.step);
+  for(i = 0; i < 4; ++i) {
+    FIELD(gb->apu.ch[i].enabled);
+    FIELD(gb->apu.ch[i].length);
+    FIELD(gb->apu.ch[i].volume);
+    FIELD(gb->apu.ch[i].env_timer);
+    FIELD(gb->apu.ch[i].level);
+  }
+  FIELD(gb->apu.shadow);
+  FIELD(gb->apu.sweep_timer);
+  FIELD(gb->apu.sweep_on);
+  
+  /* Memory from 0x8000 up, the other VRAM and WRAM banks, and the
+   * cartridge's RAM, whose size the header gives. A page at a time only
+   * when forking or shared with a fork, since fewer, larger copies are
+   * quicker. */
+  if(from || gb->fork.held) {
+    RANGE(&MEM(0x8000), 0x2000);
+    for(i = 0; i < 4; ++i) SLOT(i);
+    RANGE(&MEM(0xe000), 0x2000);
+    FIELD(gb->cgb.vram1);
+    for(i = 4; i < slots; ++i) SLOT(i);
+    return n;
+  }
+  
+  FIELD(gb->memory);
+  FIELD(gb->cgb.vram1);
+  FIELD(gb->cgb.wram);
+  if(p && gb->cart.ram) {
+    if(save) memcpy(p + n, gb->cart.ram, gb->cart.ram_size);
+    else     memcpy(gb->cart.ram, p + n, gb->cart.ram_size);
+  }
+  n += gb->cart.ram_size;
+  
+  return n;
+}
+
+/* Identifies the game by the checksums and CGB flag in its header. */
+static uint32_t state_rom(gb_t *gb) {
+  const uint8_t *d;
+  
+  if(!gb->cart.rom)
+    return 0;
+  
+  d = gb->cart.rom->data;
+  return d[0x14d] | (d[0x14e] << 8) | (d[0x14f] << 16) | ((uint32_t)d[0x143] << 24);
+}
+
+/* Returns how large a buffer state_save() needs, compressed or not. */
+size_t state_size(gb_t *gb) {
+  return sizeof(state_header_t) + lz_bound(state_fields(gb, NULL, 1, NULL));
+}
+
+/* Returns where memory starts in a raw state. From there on the layout is
+ * whole 4 KB pages of memory, which is where snap.h cuts states. */
+size_t state_memory(gb_t *gb) {
+  return sizeof(state_header_t) + state_fields(gb, NULL, 1, NULL) - sizeof gb->memory -
+         sizeof gb->cgb.vram1 - sizeof gb->cgb.wram - gb->cart.ram_size;
+}
+
+/* Saves the state into buf, which holds size bytes. Returns the size of the
+ * blob, or 0 if it doesn't fit or memory runs out for compressing. */
+size_t state_save(gb_t *gb, void *buf, size_t size, int flags) {
+  state_header_t  header;
+  uint8_t        *out  = buf;
+  size_t          body = state_fields(gb, NULL, 1, NULL);
+  
+  header.magic    = STATE_MAGIC;
+  header.version  = STATE_VERSION;
+  header.flags    = flags & STATE_COMPRESS;
+  header.size     = sizeof header + body;
+  header.rom      = state_rom(gb);
+  header.cart_ram = gb->cart.ram_size;
+  
+  if(flags & STATE_COMPRESS) {
+    uint8_t *raw;
+    
+    if((size < state_size(gb)) || !(raw = malloc(body)))
+      return 0;
+    state_fields(gb, raw, 1, NULL);
+    header.stored = lz_compress(raw, body, out + sizeof header);
+    free(raw);
+  }
+  
+  else {
+    if(size < sizeof header + body)
+      return 0;
+    state_fields(gb, out + sizeof header, 1, NULL);
+    header.stored = body;
+  }
+  
+  memcpy(out, &header, sizeof header);
+  return sizeof header + header.stored;
+}
+
+/* Loads a state saved from the same game. Returns 0, leaving the instance
+ * as it was, if the blob is from another game or version, or is cut short
+ * or malformed. There is no checksum: a flipped bit in the data loads. */
+int state_load(gb_t *gb, const void *buf, size_t size) {
+  state_header_t  header;
+  const uint8_t  *in   = buf;
+  size_t          body = state_fields(gb, NULL, 0, NULL);
+  
+  if(size < sizeof header)
+    return 0;
+  memcpy(&header, in, sizeof header);
+  
+  if((header.magic != STATE_MAGIC) || (header.version != STATE_VERSION) ||
+     (header.rom != state_rom(gb)) || (header.cart_ram != gb->cart.ram_size) ||
+     (header.size != sizeof header + body) || (header.stored > size - sizeof header))
+    return 0;
+  
+  if(header.flags & STATE_COMPRESS) {
+    uint8_t *raw = malloc(body);
+    
+    if(!raw)
+      return 0;
+    if(lz_decompress(in + sizeof header, header.stored, raw, body) != body) {
+      free(raw);
+      return 0;
+    }
+    fork_drop(gb);
+    state_fields(gb, raw, 0, NULL);
+    free(raw);
+  }
+  
+  else {
+    if(header.stored != body)
+      return 0;
+    fork_drop(gb);
+    state_fields(gb, (uint8_t *)in + sizeof header, 0, NULL);
+  }
+  
+  /* Pointers and caches follow from what was loaded. */
+  z80_remap(gb);
+  apu_resume(gb);
+  gb_lcd_resume(gb);
+  return 1;
+}
+
+/* Puts child in parent's state, as saving parent and loading the state into
+ * child would, without a blob: WRAM and cartridge RAM are shared copy on
+ * write rather than copied. Neither instance may be running meanwhile.
+ * Returns 0, leaving child as it was, if the two aren't on the same game. */
+int state_fork(gb_t *child, gb_t *parent) {
+  if((child == parent) || (state_rom(child) != state_rom(parent)) ||
+     (child->cart.ram_size != parent->cart.ram_size))
+    return 0;
+  
+  fork_drop(child);
+  state_fields(child, NULL, 0, parent);
+  
+  /* Both map what they now share for reads only. */
+  z80_remap(parent);
+  z80_remap(child);
+  apu_resume(child);
+  gb_lcd_resume(child);
+  return 1;
+}
@@ -25,9 +25,18 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <nds.h>
 
+#include "apu.h"
+#include "bgcache.h"
+#include "cart.h"
+#include "cgb.h"
+#include "fork.h"
 #include "instructions.h"
+#include "joypad.h"
+#include "sched.h"
+#include "serial.h"
 #include "z80.h"
 #include "gb.h"
 
@@ -41,38 +50,131 @@
 #define TODO(ins)      iprintf("TODO: %s\n", ins); for(;;)
 #define POLL()         if(sstep) { do { scanKeys(); if(keysDown() & KEY_B) break; if(keysDownRepeat() & KEY_A) break; } while(1); }
   
-/* Actual Z80 memory. */
-uint8_t z80_memory[0x10000] = {0};
+/* Each 4 KB page is mapped in gb->mapped for reads and gb->wmapped for
+ * writes. Switchable banks are mapped by pointing their pages elsewhere:
+ * ROM banks into the shared image, which is never written, and cartridge
+ * RAM into the instance's own. The last page holds OAM and I/O, so only
+ * 0xe000-0xefff can point at the RAM it echoes; see PUT8 for the rest.
+ *
+ * The CPU reads and writes each page through gb->pages and gb->wpages: the
+ * mapped memory, except while OAM DMA holds the bus. Then everything below
+ * 0xf000 reads as 0xff and ignores writes, and only the last page, with I/O
+ * and HRAM, is reachable. */
+
+/* OAM DMA holds the bus for 160 M-cycles. */
+#define DMA_CYCLES (160 * 4)
+
+/* Reads and writes that only the opcode table uses. */
+#define GET16(addr)        z80_get16(gb, addr)
+#define PUT16(addr, value) z80_put16(gb, addr, value)
+#define POPWORD()          z80_pop(gb)
 
-/* Underlying register implementation. */
-uint8_t  IME = 1;
-uint8_t  _AF[2], _BC[2], _DE[2], _HL[2];
-uint16_t _SP,    _PC;
+int debug = 0;
 
-/* Temporaries. */
-uint8_t  T1, T2;
-uint16_t T3;
-uint32_t T4;
-int16_t  S1;
+/* Maps a page for reading and writing separately and, unless the bus is
+ * held, points the CPU at it. Pages shared with a fork are mapped for reads
+ * only; see fork.h. */
+void z80_map(gb_t *gb, int page, const uint8_t *read, uint8_t *write) {
+  if(gb->fork.held) fork_map(gb, page, &read, &write);
+  
+  gb->mapped[page]  = read;
+  gb->wmapped[page] = write;
+  
+  if(!gb->bus_locked || (page == 0xf)) {
+    gb->pages[page]  = read;
+    gb->wpages[page] = write;
+  }
+}
 
-int debug = 0;
+/* Maps a page of memory the CPU can both read and write. */
+void z80_map_page(gb_t *gb, int page, uint8_t *mem) {
+  z80_map(gb, page, mem, mem);
+}
+
+/* Holds or releases the bus by swapping page pointers. */
+static void z80_lock(gb_t *gb, int locked) {
+  int i;
+  
+  gb->bus_locked = locked;
+  for(i = 0; i < 0xf; ++i) {
+    gb->pages[i]  = locked ? gb->open_bus : gb->mapped[i];
+    gb->wpages[i] = locked ? gb->bus_sink : gb->wmapped[i];
+  }
+}
+
+/* Maps every page from 0x8000 up to memory, releasing the bus. The ROM is
+ * left to cart_reset(), and reads as open bus until then. */
+void z80_init(gb_t *gb) {
+  int i;
+  
+  memset(gb->open_bus, 0xff, sizeof gb->open_bus);
+  
+  gb->bus_locked = 0;
+  for(i = 0; i < 8; ++i)
+    z80_map(gb, i, gb->open_bus, gb->bus_sink);
+  for(i = 8; i < 16; ++i)
+    z80_map_page(gb, i, &MEM(i * 0x1000));
+  z80_map_page(gb, 0xe, &MEM(0xc000));
+}
+
+/* Rebuilds the page tables from the banks the cartridge and the CGB have
+ * selected, and holds the bus again if DMA held it. For loading states. */
+void z80_remap(gb_t *gb) {
+  int locked = gb->bus_locked;
+  
+  z80_init(gb);
+  cart_map(gb);
+  cgb_map(gb);
+  z80_lock(gb, locked);
+}
+
+void z80_dma_end(gb_t *gb) {
+  z80_lock(gb, 0);
+}
+
+/* Performs an OAM DMA transfer from value * 0x100. The 0xa0 bytes never
+ * cross a page, so they are copied at once; pending lines are drawn first
+ * and sprites are rebuilt once. The CPU is then kept to the last page until
+ * the transfer would have finished. */
+static void z80_dma(gb_t *gb, uint8_t value) {
+  uint16_t       src = value << 8;
+  const uint8_t *p   = &gb->mapped[src >> 12][src & 0xfff];
+  
+  if(memcmp(&MEM(0xfe00), p, 0xa0)) {
+    if(gb->lcd_pending) gb_lcd_flush(gb);
+    memcpy(&MEM(0xfe00), p, 0xa0);
+    gb->lcd_dirty = 1;
+  }
+  
+  z80_lock(gb, 1);
+  sched_at(gb, SCHED_DMA, DMA_CYCLES >> gb->cgb.speed);
+}
 
 /* Inline functions used for memory retrieval. */
-inline uint8_t GET8(uint16_t addr) {
-  /* TODO: Add support for bank-switching. */
-  return z80_memory[addr];
+inline uint8_t z80_get8(gb_t *gb, uint16_t addr) {
+  return gb->pages[addr >> 12][addr & 0xfff];
 }
 
-inline uint16_t GET16(uint16_t addr) {
+/* Loads, which unlike instruction fetches can find P1, worked out as it is
+ * read, and OAM, which reads as 0xff while DMA holds the bus. */
+inline uint8_t z80_getmem(gb_t *gb, uint16_t addr) {
+  if(__builtin_expect(addr >= 0xfe00, 0)) {
+    if(addr == 0xff00) return joypad_read(gb);
+    if(gb->bus_locked && (addr < 0xfea0)) return 0xff;
+  }
+  return GET8(addr);
+}
+
+inline uint16_t z80_get16(gb_t *gb, uint16_t addr) {
   return (GET8(addr+1) << 8) | GET8(addr);
 }
 
-inline void PUSHWORD(uint16_t word) {
+inline void z80_push(gb_t *gb, uint16_t word) {
   PUT8(--SP, (word >> 8) & 0xff);
   PUT8(--SP, (word >> 0) & 0xff);
 }
 
-inline uint16_t POPWORD() {
+inline uint16_t z80_pop(gb_t *gb) {
   uint16_t t;
   
   t   = GET8(SP+1) << 8 ;
@@ -83,56 +185,118 @@ inline uint16_t POPWORD() {
 }
 
 /* Inline functions used for memory modification. */
-void PUT8(uint16_t addr, uint8_t value) {
-  /* Disallow write access to ROM. */
-  if(addr < 0x8000) { }
+void z80_put8(gb_t *gb, uint16_t addr, uint8_t value) {
+  /* ROM can't be written; the bank controller takes the writes. */
+  if(addr < 0x8000) {
+    cart_write(gb, addr, value);
+  }
   
-  /* TODO: Add support for switchable RAM banks. */
-
-  /* Writing to ECHO RAM also writes in regular RAM. */
-  if((addr >= 0xe000) && (addr <= 0xfdff)) {
-    z80_memory[addr] = value;
-    z80_memory[addr - 0x2000] = value;
+  /* Writing to ECHO RAM past 0xf000 also writes in regular RAM. Page 0xf
+   * stays mapped while DMA holds the bus, so the echo is dropped here. */
+  else if((addr >= 0xf000) && (addr <= 0xfdff)) {
+    uint8_t *p = gb->wpages[0xd];
+    
+    if(gb->bus_locked)
+      return;
+    if(__builtin_expect(!p, 0)) p = fork_write(gb, 0xd);
+    MEM(addr) = value;
+    p[addr & 0xfff] = value;
+  }
+  
+  /* Keep the background cache informed of VRAM changes. A write while DMA
+   * holds the bus goes nowhere, and changes nothing. */
+  else if((addr >= 0x8000) && (addr < 0xa000)) {
+    uint8_t *p = &gb->wpages[addr >> 12][addr & 0xfff];
+    
+    if(gb->bus_locked)
+      return;
+    if(*p != value) {
+      if(gb->lcd_pending) gb_lcd_flush(gb);
+      *p            = value;
+      gb->lcd_dirty = 1;
+      bgcache_write(gb, addr);
+    }
+  }
+  
+  /* Sprite attribute table, which DMA owns while it holds the bus. */
+  else if((addr >= 0xfe00) && (addr < 0xfea0)) {
+    if(gb->bus_locked)
+      return;
+    if(MEM(addr) != value) {
+      if(gb->lcd_pending) gb_lcd_flush(gb);
+      MEM(addr) = value;
+      gb->lcd_dirty    = 1;
+    }
   }
   
   /* Disallow write access to restricted area. */
   else if((addr >= 0xfea0) && (addr < 0xfeff)) { }
   
+  /* Only P1's select lines can be written. */
+  else if(addr == 0xff00) {
+    joypad_write(gb, value);
+  }
+  
+  /* The serial port. */
+  else if((addr == 0xff01) || (addr == 0xff02)) {
+    serial_write(gb, addr, value);
+  }
+  
   /* Writes to the division register zero it. */
   else if(addr == 0xff04) {
-    z80_memory[addr] = 0;
+    MEM(addr) = 0;
+  }
+  
+  /* Sound registers and wave RAM. */
+  else if((addr >= 0xff10) && (addr < 0xff40)) {
+    apu_write(gb, addr, value);
   }
   
   /* Writes to the timer control register means we need to update it. */
   else if(addr == 0xff07) {
-    uint8_t t        = z80_memory[addr];
-    z80_memory[addr] = value;
+    uint8_t t        = MEM(addr);
+    MEM(addr) = value;
     
     if(t != value) {
-      gb_set_clock();
+      gb_set_clock(gb);
     }
   }
   
+  /* LCDC picks the line renderer and tile data addressing. */
+  else if(addr == 0xff40) {
+    gb_lcdc_write(gb, value);
+    MEM(addr) = value;
+  }
+  
   /* Zero the scanline register upon write. */
   else if(addr == 0xff44) {
-    z80_memory[addr] = 0;
+    MEM(addr) = 0;
   }
   
   /* Perform a DMA transfer. The data being written is the source address
    * divided by 100. DMA only has one destination; 0xfe00. 0xa0 bytes are
    * always written. */
   else if(addr == 0xff46) {
-    uint16_t i, src = value << 8;
-    for(i = 0; i < 0xa0; ++i) PUT8(0xfe00+i, GET8(src+i));
+    MEM(addr) = value;
+    z80_dma(gb, value);
+  }
+  
+  /* Banks, palettes and HDMA of the Game Boy Color. */
+  else if(gb->cgb.enabled && (addr >= 0xff4d) && (addr <= 0xff70)) {
+    cgb_write(gb, addr, value);
   }
   
-  /* Otherwise, this is regular memory. */
+  /* Otherwise, this is regular memory, which may be banked, or shared with
+   * a fork until written. */
   else {
-    z80_memory[addr] = value;
+    uint8_t *p = gb->wpages[addr >> 12];
+    
+    if(__builtin_expect(!p, 0)) p = fork_write(gb, addr >> 12);
+    p[addr & 0xfff] = value;
   }
 }
 
-inline void PUT16(uint16_t addr, uint16_t value) {
+inline void z80_put16(gb_t *gb, uint16_t addr, uint16_t value) {
   PUT8(addr,     (value >> 8) & 0xff);
   PUT8(addr + 1, (value >> 0) & 0xff);
 }
@@ -154,8 +318,14 @@ inline int CSUB(uint8_t a, uint8_t b) {
   return ((a - b) & 0xff) ? 0 : CARRY;
 }
 
-uint8_t z80_execute() {
-  uint8_t actual = 0;
+uint8_t z80_execute(gb_t *gb) {
+  uint8_t  actual = 0;
+  
+  /* Temporaries. */
+  uint8_t  T1, T2;
+  uint16_t T3;
+  uint32_t T4;
+  int16_t  S1;
   
   if(sstep) {
     iprintf("%04x: ", PC);